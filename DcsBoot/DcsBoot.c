@@ -246,11 +246,14 @@ DcsBootMain(
 	EFI_GUID          *pDefaultExecPartGuid = &ImagePartGuid;
 //	EFI_INPUT_KEY       key;
 
+	TraceMark("DcsBoot");
 	InitBio();
    res = InitFS();
    if (EFI_ERROR(res)) {
       ERR_PRINT(L"InitFS %r\n", res);
    }
+	TraceMark("InitBio/InitFS");
+	gTraceSave = ConfigReadInt("TraceBoot", 0);
 
    // BML installed?
    if (EFI_ERROR(InitBml())) {
@@ -280,9 +283,11 @@ DcsBootMain(
 			gST->RuntimeServices->ResetSystem(EfiResetCold, EFI_SUCCESS, 0, NULL);
 		}
 	}
+	TraceMark("DcsInfo");
 
 	// Load all drivers
 	res = EfiExec(NULL, L"\\EFI\\VeraCrypt\\LegacySpeaker.dcs");
+	TraceMark("LegacySpeaker");
 
 	res = EfiGetPartGUID(gFileRootHandle, &ImagePartGuid);
 	if (EFI_ERROR(res)) {
@@ -298,6 +303,8 @@ DcsBootMain(
 	// Authorize
 	gBS->SetWatchdogTimer(0, 0, 0, NULL);
 	res = EfiExec(NULL, L"\\EFI\\VeraCrypt\\DcsInt.dcs");
+	TraceMark("DcsInt");
+	TraceSave();
    if (EFI_ERROR(res) && (res != EFI_DCS_POSTEXEC_REQUESTED)) {
 
       // Clear DcsExecPartGuid before execute OS to avoid problem in VirtualBox with reboot.
@@ -356,6 +363,8 @@ DcsBootMain(
     ConnectAllEfi();
 	InitBio();
 	res = InitFS();
+	TraceMark("DoExecCmd");
+	TraceSave();
 
 	while (1)
 	{
@@ -44,6 +44,11 @@ BlockRangeWipe(
 //////////////////////////////////////////////////////////////////////////
 // System crypt
 //////////////////////////////////////////////////////////////////////////
+extern UINTN gCryptBufCount;
+extern UINTN gCryptCheckpointMB;
+extern UINTN gCryptCheckpointSeconds;
+extern UINTN gCryptChunkKB;
+
 EFI_STATUS
 VolumeEncrypt(
 	IN UINTN index);
@@ -83,6 +88,12 @@ GptEdit(
 EFI_STATUS
 OuterInit();
 
+// Time ciphers and PRFs, recommend PIM for unlock time targetMs (0 - 2000)
+EFI_STATUS
+CryptBenchmark(
+	IN UINTN targetMs
+	);
+
 //////////////////////////////////////////////////////////////////////////
 // Security regions
 //////////////////////////////////////////////////////////////////////////
@@ -102,7 +113,13 @@ SecRegionAdd(
 EFI_STATUS
 SecRegionDump(
 	IN EFI_HANDLE   hBio,
-	IN CHAR16       *prefix
+	IN CHAR16       *fileName
+	);
+
+EFI_STATUS
+SecRegionRestore(
+	IN EFI_HANDLE   hBio,
+	IN CHAR16       *fileName
 	);
 
 //////////////////////////////////////////////////////////////////////////
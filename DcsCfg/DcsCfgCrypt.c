@@ -21,6 +21,7 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Library/PrintLib.h>
 #include <Guid/Gpt.h>
 #include <Guid/GlobalVariable.h>
+#include <Protocol/BlockIo2.h>
 
 #include <Library/CommonLib.h>
 #include <Library/GraphLib.h>
@@ -93,9 +94,15 @@ AskPkcs5() {
 	return pkcs5;
 }
 
+/**
+Try to decrypt several headers (disks) at once. Index of first header
+decrypted is returned in foundIdx.
+**/
 EFI_STATUS
-TryHeaderDecrypt(
-	IN  CHAR8*                  header,
+TryHeadersDecrypt(
+	IN  CHAR8**                 headers,
+	IN  UINTN                   count,
+	OUT UINTN                   *foundIdx,
 	OUT PCRYPTO_INFO            *rci,
 	OUT PCRYPTO_INFO            *rhci
 	) 
@@ -108,17 +115,20 @@ TryHeaderDecrypt(
 		headerCryptoInfo = crypto_open();
 	}
 
-	vcres = ReadVolumeHeader(
+	vcres = ReadVolumeHeadersMp(
 		gAuthBoot,
-		header,
+		(char**)headers,
+		count,
 		&gAuthPassword,
 		gAuthHash,
 		gAuthPim,
+		foundIdx,
 		&cryptoInfo,
 		headerCryptoInfo);
 
 	if (vcres != 0) {
 		ERR_PRINT(L"Authorization failed. Wrong password, PIM or hash. Decrypt error(%x)\n", vcres);
+		if (headerCryptoInfo != NULL) crypto_close(headerCryptoInfo);
 		return EFI_INVALID_PARAMETER;
 	}
 	OUT_PRINT(L"%H" L"Success\n" L"%N", vcres);
@@ -133,6 +143,16 @@ TryHeaderDecrypt(
 	return EFI_SUCCESS;
 }
 
+EFI_STATUS
+TryHeaderDecrypt(
+	IN  CHAR8*                  header,
+	OUT PCRYPTO_INFO            *rci,
+	OUT PCRYPTO_INFO            *rhci
+	) 
+{
+	return TryHeadersDecrypt(&header, 1, NULL, rci, rhci);
+}
+
 EFI_STATUS
 ChangePassword(
 	IN OUT CHAR8*                  header
@@ -402,7 +422,425 @@ RangeCryptProgress(
 	OUT_PRINT(L"        \r");
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Parallel crypt
+//////////////////////////////////////////////////////////////////////////
+// XTS data units are independent. Buffer is split to slices and slices
+// are processed by all processors available.
+#define CRYPT_MP_SLICE_SECTORS 2048
+
+typedef struct _CRYPT_MP_JOB {
+	UINT8*        Buf;
+	UINT64        Sector;
+	UINTN         Count;
+	PCRYPTO_INFO  Info;
+	BOOL          Encrypt;
+} CRYPT_MP_JOB;
+
+VOID
+CryptDataUnitsSlice(
+	IN VOID*  ctx,
+	IN UINTN  slice
+	)
+{
+	CRYPT_MP_JOB* job = (CRYPT_MP_JOB*)ctx;
+	UINTN         first = slice * CRYPT_MP_SLICE_SECTORS;
+	UINTN         count = job->Count - first;
+	UINT64        sector = job->Sector + first;
+	if (count > CRYPT_MP_SLICE_SECTORS) count = CRYPT_MP_SLICE_SECTORS;
+	if (job->Encrypt) {
+		EncryptDataUnits(job->Buf + (first << 9), (UINT64_STRUCT*)&sector, (UINT32)count, job->Info);
+	}	else {
+		DecryptDataUnits(job->Buf + (first << 9), (UINT64_STRUCT*)&sector, (UINT32)count, job->Info);
+	}
+}
+
+VOID
+CryptDataUnitsMp(
+	IN OUT UINT8*        buf,
+	IN     UINT64        sector,
+	IN     UINTN         count,
+	IN     PCRYPTO_INFO  info,
+	IN     BOOL          encrypt
+	)
+{
+	CRYPT_MP_JOB job;
+	job.Buf = buf;
+	job.Sector = sector;
+	job.Count = count;
+	job.Info = info;
+	job.Encrypt = encrypt;
+	MpRunSlices(CryptDataUnitsSlice, &job, (count + CRYPT_MP_SLICE_SECTORS - 1) / CRYPT_MP_SLICE_SECTORS);
+}
+
 #define CRYPT_BUF_SECTORS 50*1024*2
+
+//////////////////////////////////////////////////////////////////////////
+// Range crypt pipeline
+//////////////////////////////////////////////////////////////////////////
+// Read of next chunks, crypt of current chunk and write of previous chunks
+// are overlapped if block device supports EFI_BLOCK_IO2_PROTOCOL.
+#define CRYPT_BUF_COUNT_MAX 8
+UINTN gCryptBufCount = 3;
+
+typedef struct _RANGE_CRYPT_SLOT {
+	UINT8*               Buf;
+	UINTN                BufSectors;
+	UINT64               Pos;
+	UINTN                Count;
+	BOOLEAN              Pending;
+	EFI_STATUS           Status;
+	EFI_BLOCK_IO2_TOKEN  Token;
+} RANGE_CRYPT_SLOT;
+
+/**
+Start read or write of slot. If async is FALSE or no EFI_BLOCK_IO2_PROTOCOL,
+I/O is completed on return. Result is returned by RangeCryptSlotWait.
+**/
+VOID
+RangeCryptSlotIo(
+	IN     EFI_BLOCK_IO_PROTOCOL   *io,
+	IN     EFI_BLOCK_IO2_PROTOCOL  *io2,
+	IN OUT RANGE_CRYPT_SLOT        *slot,
+	IN     BOOLEAN                 write,
+	IN     BOOLEAN                 async
+	)
+{
+	EFI_BLOCK_IO2_TOKEN  syncToken;
+	EFI_BLOCK_IO2_TOKEN  *token = &slot->Token;
+	slot->Pending = FALSE;
+	if (io2 == NULL) {
+		if (write) {
+			slot->Status = io->WriteBlocks(io, io->Media->MediaId, slot->Pos, slot->Count << 9, slot->Buf);
+		}	else {
+			slot->Status = io->ReadBlocks(io, io->Media->MediaId, slot->Pos, slot->Count << 9, slot->Buf);
+		}
+		return;
+	}
+	if (!async || token->Event == NULL) {
+		ZeroMem(&syncToken, sizeof(syncToken));
+		token = &syncToken;
+	}
+	token->TransactionStatus = EFI_NOT_READY;
+	if (write) {
+		slot->Status = io2->WriteBlocksEx(io2, io2->Media->MediaId, slot->Pos, token, slot->Count << 9, slot->Buf);
+	}	else {
+		slot->Status = io2->ReadBlocksEx(io2, io2->Media->MediaId, slot->Pos, token, slot->Count << 9, slot->Buf);
+	}
+	if (!EFI_ERROR(slot->Status) && token->Event != NULL) {
+		slot->Pending = TRUE;
+	}
+}
+
+BOOLEAN
+RangeCryptSlotDone(
+	IN OUT RANGE_CRYPT_SLOT  *slot
+	)
+{
+	if (slot->Pending && gBS->CheckEvent(slot->Token.Event) == EFI_SUCCESS) {
+		slot->Pending = FALSE;
+		slot->Status = slot->Token.TransactionStatus;
+	}
+	return !slot->Pending;
+}
+
+EFI_STATUS
+RangeCryptSlotWait(
+	IN OUT RANGE_CRYPT_SLOT  *slot
+	)
+{
+	UINTN idx;
+	if (slot->Pending) {
+		gBS->WaitForEvent(1, &slot->Token.Event, &idx);
+		slot->Pending = FALSE;
+		slot->Status = slot->Token.TransactionStatus;
+	}
+	return slot->Status;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Range crypt I/O size
+//////////////////////////////////////////////////////////////////////////
+// Chunks are aligned to physical block and optimal transfer granularity of
+// media. Unaligned head of range is processed as separate short chunk.
+// If gCryptChunkKB is 0, chunk size is selected by read speed probe.
+#define CRYPT_PROBE_BYTES (16 * 1024 * 1024)
+UINTN gCryptChunkKB = 0;
+UINTN gCryptProbeSectors[] = { 256 * 2, 1024 * 2, 4 * 1024 * 2, 16 * 1024 * 2, CRYPT_BUF_SECTORS };
+
+typedef struct _RANGE_CRYPT_IO_PARAMS {
+	UINTN   ChunkSectors;
+	UINT64  AlignSectors;
+	UINT64  AlignLba;
+	UINT32  BufAlign;
+} RANGE_CRYPT_IO_PARAMS;
+
+UINTN
+RangeCryptAlignDown(
+	IN RANGE_CRYPT_IO_PARAMS  *params,
+	IN UINTN                  sectors
+	)
+{
+	UINTN aligned = (UINTN)(sectors - sectors % params->AlignSectors);
+	return (aligned == 0) ? (UINTN)params->AlignSectors : aligned;
+}
+
+VOID
+RangeCryptIoParamsInit(
+	IN  EFI_BLOCK_IO_PROTOCOL  *io,
+	OUT RANGE_CRYPT_IO_PARAMS  *params
+	)
+{
+	EFI_BLOCK_IO_MEDIA *media = io->Media;
+	params->AlignSectors = 1;
+	params->AlignLba = 0;
+	params->BufAlign = media->IoAlign;
+	if (io->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION2) {
+		params->AlignLba = media->LowestAlignedLba;
+		if (media->LogicalBlocksPerPhysicalBlock > 1) {
+			params->AlignSectors = media->LogicalBlocksPerPhysicalBlock;
+		}
+	}
+	if (io->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3 &&
+		media->OptimalTransferLengthGranularity > params->AlignSectors &&
+		media->OptimalTransferLengthGranularity <= CRYPT_BUF_SECTORS) {
+		params->AlignSectors = media->OptimalTransferLengthGranularity;
+	}
+	params->ChunkSectors = RangeCryptAlignDown(params, CRYPT_BUF_SECTORS);
+	if (gCryptChunkKB != 0 && gCryptChunkKB * 2 < CRYPT_BUF_SECTORS) {
+		params->ChunkSectors = RangeCryptAlignDown(params, gCryptChunkKB * 2);
+	}
+}
+
+/**
+Size of next chunk. First chunk is cut to end on aligned LBA
+(encrypt - planPos is start of chunk, decrypt - planPos is end of chunk).
+**/
+UINTN
+RangeCryptChunk(
+	IN RANGE_CRYPT_IO_PARAMS  *params,
+	IN UINT64                 planPos,
+	IN UINT64                 planRemains,
+	IN BOOL                   encrypt
+	)
+{
+	UINT64 count = params->ChunkSectors;
+	UINT64 head = 0;
+	if (params->AlignSectors > 1 && planPos >= params->AlignLba) {
+		head = (planPos - params->AlignLba) % params->AlignSectors;
+	}
+	if (head != 0) {
+		count = encrypt ? params->AlignSectors - head : head;
+	}
+	if (count > planRemains) count = planRemains;
+	return (UINTN)count;
+}
+
+/**
+Read only probe: select chunk size with best read speed.
+**/
+VOID
+RangeCryptProbe(
+	IN     EFI_BLOCK_IO_PROTOCOL  *io,
+	IN OUT RANGE_CRYPT_IO_PARAMS  *params,
+	IN     UINT8*                 buf,
+	IN     UINT64                 start,
+	IN     UINT64                 size
+	)
+{
+	EFI_STATUS  res;
+	UINTN       i;
+	UINTN       sectors;
+	UINT64      offset = 0;
+	UINT64      bytes;
+	UINT64      us;
+	UINT64      rate;
+	UINT64      bestRate = 0;
+	UINT64      ticks;
+
+	// Start from aligned LBA
+	offset = RangeCryptChunk(params, start, size, TRUE);
+	if (offset == params->ChunkSectors) offset = 0;
+	for (i = 0; i < sizeof(gCryptProbeSectors) / sizeof(gCryptProbeSectors[0]); ++i) {
+		sectors = RangeCryptAlignDown(params, gCryptProbeSectors[i]);
+		bytes = 0;
+		res = EFI_SUCCESS;
+		ticks = TimerTicks();
+		while (bytes < CRYPT_PROBE_BYTES && offset + sectors <= size) {
+			res = io->ReadBlocks(io, io->Media->MediaId, start + offset, sectors << 9, buf);
+			if (EFI_ERROR(res)) break;
+			offset += sectors;
+			bytes += sectors << 9;
+		}
+		us = TimerElapsedUs(ticks);
+		if (EFI_ERROR(res) || bytes < CRYPT_PROBE_BYTES || us == 0) break;
+		rate = bytes / us;
+		if (rate >= bestRate) {
+			bestRate = rate;
+			params->ChunkSectors = sectors;
+		}
+	}
+	MEM_BURN(buf, CRYPT_BUF_SECTORS << 9);
+	if (bestRate > 0) {
+		OUT_PRINT(L"Chunk: %dKB (%lldMB/s)\n", params->ChunkSectors >> 1, bestRate);
+	}
+}
+
+UINT8*
+RangeCryptBufAlloc(
+	IN UINTN   sectors,
+	IN UINT32  ioAlign
+	)
+{
+	return AllocateAlignedPages(EFI_SIZE_TO_PAGES(sectors << 9), (ioAlign > EFI_PAGE_SIZE) ? ioAlign : EFI_PAGE_SIZE);
+}
+
+VOID
+RangeCryptBufFree(
+	IN UINT8*  buf,
+	IN UINTN   sectors
+	)
+{
+	if (buf == NULL) return;
+	MEM_BURN(buf, sectors << 9);
+	FreeAlignedPages(buf, EFI_SIZE_TO_PAGES(sectors << 9));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Encrypted area checkpoint
+//////////////////////////////////////////////////////////////////////////
+// Decrypted header is read once and kept in memory. EncryptedAreaLength is
+// written after data is flushed to media, so header never covers data not
+// yet written. Checkpoint is done every gCryptCheckpointMB or
+// gCryptCheckpointSeconds (0 0 - after every chunk).
+
+UINTN gCryptCheckpointMB = 0;
+UINTN gCryptCheckpointSeconds = 0;
+
+typedef struct _RANGE_CRYPT_CHECKPOINT {
+	EFI_BLOCK_IO_PROTOCOL  *Io;
+	PCRYPTO_INFO           HeaderInfo;
+	UINT64                 HeaderSector;
+	UINT8*                 Header;
+	UINT8*                 Buf;
+	UINT64                 Flushed;
+	UINT64                 Current;
+	UINTN                  FlushedScnd;
+} RANGE_CRYPT_CHECKPOINT;
+
+EFI_STATUS
+RangeCryptCheckpointOpen(
+	OUT RANGE_CRYPT_CHECKPOINT  *cp,
+	IN  EFI_BLOCK_IO_PROTOCOL   *io,
+	IN  PCRYPTO_INFO            headerInfo,
+	IN  UINT64                  headerSector
+	)
+{
+	EFI_STATUS res;
+	ZeroMem(cp, sizeof(*cp));
+	cp->Io = io;
+	cp->HeaderInfo = headerInfo;
+	cp->HeaderSector = headerSector;
+	cp->Header = MEM_ALLOC(512);
+	cp->Buf = MEM_ALLOC(512);
+	if (cp->Header == NULL || cp->Buf == NULL) {
+		res = EFI_BUFFER_TOO_SMALL;
+		goto err;
+	}
+	res = io->ReadBlocks(io, io->Media->MediaId, headerSector, 512, cp->Header);
+	if (EFI_ERROR(res)) goto err;
+	DecryptBuffer(cp->Header + HEADER_ENCRYPTED_DATA_OFFSET, HEADER_ENCRYPTED_DATA_SIZE, headerInfo);
+	if (GetHeaderField32(cp->Header, TC_HEADER_OFFSET_MAGIC) != 0x56455241) {
+		res = EFI_CRC_ERROR;
+		goto err;
+	}
+	cp->Flushed = BE64(*(uint64 *)(cp->Header + TC_HEADER_OFFSET_ENCRYPTED_AREA_LENGTH));
+	cp->Current = cp->Flushed;
+	return EFI_SUCCESS;
+
+err:
+	ERR_PRINT(L"Header read: %r\n", res);
+	MEM_BURN(cp->Header, 512);
+	MEM_FREE(cp->Header);
+	MEM_FREE(cp->Buf);
+	cp->Header = NULL;
+	cp->Buf = NULL;
+	return res;
+}
+
+EFI_STATUS
+RangeCryptCheckpointFlush(
+	IN OUT RANGE_CRYPT_CHECKPOINT  *cp
+	)
+{
+	EFI_STATUS             res;
+	EFI_BLOCK_IO_PROTOCOL  *io = cp->Io;
+	UINT32                 headerCrc32;
+	UINT8*                 headerData;
+
+	if (cp->Header == NULL || cp->Current == cp->Flushed) return EFI_SUCCESS;
+	// Data first
+	res = io->FlushBlocks(io);
+	if (!EFI_ERROR(res)) {
+		headerData = cp->Header + TC_HEADER_OFFSET_ENCRYPTED_AREA_LENGTH;
+		mputInt64(headerData, cp->Current);
+		headerCrc32 = GetCrc32(cp->Header + TC_HEADER_OFFSET_MAGIC, TC_HEADER_OFFSET_HEADER_CRC - TC_HEADER_OFFSET_MAGIC);
+		headerData = cp->Header + TC_HEADER_OFFSET_HEADER_CRC;
+		mputLong(headerData, headerCrc32);
+		CopyMem(cp->Buf, cp->Header, 512);
+		EncryptBuffer(cp->Buf + HEADER_ENCRYPTED_DATA_OFFSET, HEADER_ENCRYPTED_DATA_SIZE, cp->HeaderInfo);
+		res = io->WriteBlocks(io, io->Media->MediaId, cp->HeaderSector, 512, cp->Buf);
+		MEM_BURN(cp->Buf, 512);
+		if (!EFI_ERROR(res)) {
+			io->FlushBlocks(io);
+			cp->Flushed = cp->Current;
+			cp->FlushedScnd = gScndTotal;
+		}
+	}
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"Header update: %r\n", res);
+	}
+	return res;
+}
+
+/**
+Set encrypted area length to save. Header is written if checkpoint interval
+is passed or force is TRUE.
+**/
+EFI_STATUS
+RangeCryptCheckpoint(
+	IN OUT RANGE_CRYPT_CHECKPOINT  *cp,
+	IN     UINT64                  encryptedAreaLength,
+	IN     BOOLEAN                 force
+	)
+{
+	UINT64 delta;
+	if (cp->Header == NULL) return EFI_NOT_READY;
+	cp->Current = encryptedAreaLength;
+	delta = (cp->Current > cp->Flushed) ? cp->Current - cp->Flushed : cp->Flushed - cp->Current;
+	if (force ||
+		(gCryptCheckpointMB == 0 && gCryptCheckpointSeconds == 0) ||
+		(gCryptCheckpointMB != 0 && (delta >> 20) >= gCryptCheckpointMB) ||
+		(gCryptCheckpointSeconds != 0 && gScndTotal - cp->FlushedScnd >= gCryptCheckpointSeconds)) {
+		return RangeCryptCheckpointFlush(cp);
+	}
+	return EFI_SUCCESS;
+}
+
+VOID
+RangeCryptCheckpointClose(
+	IN OUT RANGE_CRYPT_CHECKPOINT  *cp
+	)
+{
+	if (cp->Header == NULL) return;
+	RangeCryptCheckpointFlush(cp);
+	MEM_BURN(cp->Header, 512);
+	MEM_FREE(cp->Header);
+	MEM_FREE(cp->Buf);
+	cp->Header = NULL;
+	cp->Buf = NULL;
+}
+
 EFI_STATUS
 RangeCrypt(
 	IN EFI_HANDLE             disk,
@@ -417,7 +855,13 @@ RangeCrypt(
 {
 	EFI_STATUS              res = EFI_SUCCESS;
 	EFI_BLOCK_IO_PROTOCOL  *io;
+	EFI_BLOCK_IO2_PROTOCOL *io2 = NULL;
+	RANGE_CRYPT_SLOT        slots[CRYPT_BUF_COUNT_MAX];
+	UINTN                   bufCount;
+	UINTN                   i;
 	UINT8*                  buf;
+	RANGE_CRYPT_CHECKPOINT  checkpoint;
+	RANGE_CRYPT_IO_PARAMS   ioParams;
 	UINT64                  remains;
 	UINT64                  remainsOnStart;
 	UINT64                  pos;
@@ -435,11 +879,51 @@ RangeCrypt(
 		return EFI_INVALID_PARAMETER;
 	}
 
-	buf = MEM_ALLOC(CRYPT_BUF_SECTORS << 9);
+	ZeroMem(slots, sizeof(slots));
+	ZeroMem(&checkpoint, sizeof(checkpoint));
+	RangeCryptIoParamsInit(io, &ioParams);
+	buf = RangeCryptBufAlloc(CRYPT_BUF_SECTORS, ioParams.BufAlign);
 	if (!buf) {
 		ERR_PRINT(L"no memory for buffer\n");
 		return EFI_INVALID_PARAMETER;
 	}
+	slots[0].Buf = buf;
+	slots[0].BufSectors = CRYPT_BUF_SECTORS;
+	bufCount = 1;
+
+	// Chunk size
+	if (gCryptChunkKB == 0 && (encrypt ? size - enSize : enSize) > 16 * CRYPT_BUF_SECTORS) {
+		RangeCryptProbe(io, &ioParams, buf, start, size);
+	}
+
+	// Pipeline buffers
+	if (gCryptBufCount > 1) {
+		res = gBS->HandleProtocol(disk, &gEfiBlockIo2ProtocolGuid, (VOID**)&io2);
+		if (EFI_ERROR(res)) {
+			io2 = NULL;
+		}
+	}
+	if (io2 != NULL) {
+		UINTN maxCount = (gCryptBufCount > CRYPT_BUF_COUNT_MAX) ? CRYPT_BUF_COUNT_MAX : gCryptBufCount;
+		for (i = 0; i < maxCount; ++i) {
+			if (i > 0) {
+				slots[i].Buf = RangeCryptBufAlloc(ioParams.ChunkSectors, ioParams.BufAlign);
+				if (slots[i].Buf == NULL) break;
+				slots[i].BufSectors = ioParams.ChunkSectors;
+			}
+			res = gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &slots[i].Token.Event);
+			if (EFI_ERROR(res)) {
+				slots[i].Token.Event = NULL;
+				if (i > 0) {
+					RangeCryptBufFree(slots[i].Buf, slots[i].BufSectors);
+					slots[i].Buf = NULL;
+				}
+				break;
+			}
+		}
+		bufCount = (i > 0) ? i : 1;
+	}
+	res = EFI_SUCCESS;
 
 	if (encrypt) {
 		remains = size - enSize;
@@ -451,21 +935,58 @@ RangeCrypt(
 		pos = start + enSize - rd;
 	}
 	remainsOnStart = remains;
+	if (headerInfo != NULL && remainsOnStart > 0) {
+		// No conversion without header updates
+		res = RangeCryptCheckpointOpen(&checkpoint, io, headerInfo, headerSector);
+		if (EFI_ERROR(res)) {
+			goto error;
+		}
+	}
+	if (gMpCpuCount > 1) {
+		OUT_PRINT(L"CPUs: %d\n", gMpCpuCount);
+	}
+	if (bufCount > 1) {
+		OUT_PRINT(L"Buffers: %d\n", bufCount);
+	}
 	// Start second
 	gScndTotal = 0;
 	gScndCurrent = 0;
 	
 	if (remainsOnStart > 0)
 	{
+		// encrypt - next sector to read, decrypt - end of range to read
+		UINT64            planPos = start + enSize;
+		UINT64            planRemains = remains;
+		UINTN             issued = 0;
+		UINTN             crypted = 0;
+		UINTN             written = 0;
+		BOOLEAN           stop = FALSE;
+		RANGE_CRYPT_SLOT* slot;
+		RangeCryptProgress(size, remains, pos, remainsOnStart);
 		do {
-			rd = (UINTN)((remains > CRYPT_BUF_SECTORS) ? CRYPT_BUF_SECTORS : remains);
-			RangeCryptProgress(size, remains, pos, remainsOnStart);
-			// Read
-			do {
-				res = io->ReadBlocks(io, io->Media->MediaId, pos, rd << 9, buf);
-				if (EFI_ERROR(res)) {
+			// Read ahead
+			while (!stop && planRemains > 0 && issued - written < bufCount) {
+				slot = &slots[issued % bufCount];
+				slot->Count = RangeCryptChunk(&ioParams, planPos, planRemains, encrypt);
+				if (encrypt) {
+					slot->Pos = planPos;
+					planPos += slot->Count;
+				}	else {
+					planPos -= slot->Count;
+					slot->Pos = planPos;
+				}
+				planRemains -= slot->Count;
+				RangeCryptSlotIo(io, io2, slot, FALSE, TRUE);
+				issued++;
+			}
+
+			// Oldest write done?
+			if (written < crypted && (crypted == issued || stop || RangeCryptSlotDone(&slots[written % bufCount]))) {
+				slot = &slots[written % bufCount];
+				res = RangeCryptSlotWait(slot);
+				while (EFI_ERROR(res)) {
 					UINT8 ari;
-					ERR_PRINT(L"Read error: %r\n", res);
+					ERR_PRINT(L"Write error: %r\n", res);
 					ari = AskARI();
 					switch (ari)
 					{
@@ -475,36 +996,48 @@ RangeCrypt(
 						break;
 					case 'A':
 					case 'a':
-						goto error;
+						goto drain;
 					case 'R':
 					case 'r':
 					default:
-						if (rd > 1) rd >>= 1;
+						RangeCryptSlotIo(io, io2, slot, TRUE, FALSE);
+						res = slot->Status;
 						break;
 					}
 				}
-			} while (EFI_ERROR(res));
-
-			// Crypt
-			if (encrypt) {
-				EncryptDataUnits(buf, (UINT64_STRUCT*)&pos, (UINT32)(rd), info);
-			}	else {
-				if (bIsSystemEncyption && (pos == start) && (0xEB52904E54465320 == BE64 (*(uint64 *) buf)))
-				{
-					// first sector is not encrypted (e.g. because of Windows repair).
-					// So we encrypt it so that decryption will lead to correct result
-					EncryptDataUnits(buf, (UINT64_STRUCT*)&pos, 1, info);
+				written++;
+				remains -= slot->Count;
+				pos = slot->Pos;
+
+				RangeCryptProgress(size, remains, pos, remainsOnStart);
+				// Update header
+				RangeCryptCheckpoint(&checkpoint, (encrypt ? size - remains : remains) << 9, remains == 0);
+
+				// Check ESC
+				if (!stop) {
+					EFI_INPUT_KEY key;
+					res = gBS->CheckEvent(gST->ConIn->WaitForKey);
+					if(!EFI_ERROR(res)) {
+						gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
+						if (key.ScanCode == SCAN_ESC) {
+							if (AskConfirm("\n\rStop?", 1)) {
+								// Complete writes already started
+								stop = TRUE;
+							}
+						}
+					}
+					res = EFI_SUCCESS;
 				}
-				
-				DecryptDataUnits(buf, (UINT64_STRUCT*)&pos, (UINT32)(rd), info);
+				continue;
 			}
 
-			// Write
-			do {
-				res = io->WriteBlocks(io, io->Media->MediaId, pos, rd << 9, buf);
-				if (EFI_ERROR(res)) {
+			// Crypt
+			if (!stop && crypted < issued) {
+				slot = &slots[crypted % bufCount];
+				res = RangeCryptSlotWait(slot);
+				while (EFI_ERROR(res)) {
 					UINT8 ari;
-					ERR_PRINT(L"Write error: %r\n", res);
+					ERR_PRINT(L"Read error: %r\n", res);
 					ari = AskARI();
 					switch (ari)
 					{
@@ -514,67 +1047,51 @@ RangeCrypt(
 						break;
 					case 'A':
 					case 'a':
-						goto error;
+						goto drain;
 					case 'R':
 					case 'r':
 					default:
+						RangeCryptSlotIo(io, io2, slot, FALSE, FALSE);
+						res = slot->Status;
 						break;
 					}
 				}
-			} while (EFI_ERROR(res));
-
-			remains -= rd;
-			if (encrypt) {
-				pos += rd;
-			}	else {
-				pos -= (rd > remains) ? remains : rd;
-			}
 
-			// Update header
-			if (headerInfo != NULL) {
-				res = io->ReadBlocks(io, io->Media->MediaId, headerSector, 512, buf);
-				if (!EFI_ERROR(res)) {
-					UINT32 headerCrc32;
-					UINT64 encryptedAreaLength;
-					UINT8* headerData;
-					if (encrypt) {
-						encryptedAreaLength = (size - remains) << 9;
-					}	else {
-						encryptedAreaLength = remains << 9;
-					}
-					DecryptBuffer(buf + HEADER_ENCRYPTED_DATA_OFFSET, HEADER_ENCRYPTED_DATA_SIZE, headerInfo);
-					if (GetHeaderField32(buf, TC_HEADER_OFFSET_MAGIC) == 0x56455241) {
-						headerData = buf + TC_HEADER_OFFSET_ENCRYPTED_AREA_LENGTH;
-						mputInt64(headerData, encryptedAreaLength);
-						headerCrc32 = GetCrc32(buf + TC_HEADER_OFFSET_MAGIC, TC_HEADER_OFFSET_HEADER_CRC - TC_HEADER_OFFSET_MAGIC);
-						headerData = buf + TC_HEADER_OFFSET_HEADER_CRC;
-						mputLong(headerData, headerCrc32);
-						EncryptBuffer(buf + HEADER_ENCRYPTED_DATA_OFFSET, HEADER_ENCRYPTED_DATA_SIZE, headerInfo);
-						res = io->WriteBlocks(io, io->Media->MediaId, headerSector, 512, buf);
-					}	else {
-						res = EFI_CRC_ERROR;
+				if (encrypt) {
+					CryptDataUnitsMp(slot->Buf, slot->Pos, slot->Count, info, TRUE);
+				}	else {
+					if (bIsSystemEncyption && (slot->Pos == start) && (0xEB52904E54465320 == BE64 (*(uint64 *) slot->Buf)))
+					{
+						// first sector is not encrypted (e.g. because of Windows repair).
+						// So we encrypt it so that decryption will lead to correct result
+						EncryptDataUnits(slot->Buf, (UINT64_STRUCT*)&slot->Pos, 1, info);
 					}
+					
+					CryptDataUnitsMp(slot->Buf, slot->Pos, slot->Count, info, FALSE);
 				}
-				if (EFI_ERROR(res)) {
-					ERR_PRINT(L"Header update: %r\n", res);
-				}
-			}
 
-			// Check ESC
-			{
-				EFI_INPUT_KEY key;
-				res = gBS->CheckEvent(gST->ConIn->WaitForKey);
-				if(!EFI_ERROR(res)) {
-					gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
-					if (key.ScanCode == SCAN_ESC) {
-						if (AskConfirm("\n\rStop?", 1)) {
-							res = EFI_NOT_READY;
-							goto error;
-						}
-					}
-				}
+				RangeCryptSlotIo(io, io2, slot, TRUE, TRUE);
+				crypted++;
 			}
-		} while (remains > 0);
+		} while (written < crypted || (!stop && (crypted < issued || planRemains > 0)));
+		if (stop) {
+			res = EFI_NOT_READY;
+		}
+
+drain:
+		// Writes of crypted chunks can be in flight. They are completed in order
+		// and saved by checkpoint up to the first failed one.
+		while (written < crypted) {
+			slot = &slots[written % bufCount];
+			if (EFI_ERROR(RangeCryptSlotWait(slot))) break;
+			written++;
+			remains -= slot->Count;
+			pos = slot->Pos;
+			RangeCryptCheckpoint(&checkpoint, (encrypt ? size - remains : remains) << 9, FALSE);
+		}
+		if (EFI_ERROR(res)) {
+			goto error;
+		}
 		RangeCryptProgress(size, remains, pos, remainsOnStart);
 	}
 	else if (!encrypt)
@@ -729,8 +1246,16 @@ RangeCrypt(
 
 error:
 	OUT_PRINT(L"\n");
-	MEM_BURN(buf, CRYPT_BUF_SECTORS << 9);
-	MEM_FREE(buf);
+	for (i = 0; i < bufCount; ++i) {
+		// Buffer can not be released while I/O is in progress
+		RangeCryptSlotWait(&slots[i]);
+		if (slots[i].Token.Event != NULL) {
+			gBS->CloseEvent(slots[i].Token.Event);
+		}
+		RangeCryptBufFree(slots[i].Buf, slots[i].BufSectors);
+	}
+	// Last completed chunk is saved even on stop or abort
+	RangeCryptCheckpointClose(&checkpoint);
 	return res;
 }
 
@@ -883,25 +1408,47 @@ OSDecrypt()
 {
 
 	EFI_STATUS              res;
-	UINTN                   disk;
+	UINTN                   disk = 0;
 	BOOLEAN                 doDecrypt = FALSE;
-	EFI_BLOCK_IO_PROTOCOL*  io;
+	CHAR8**                 headers = NULL;
+	UINTN*                  disks = NULL;
+	UINTN                   count = 0;
+	UINTN                   found = 0;
 	if (gAuthPasswordMsg == NULL) {
 		VCAuthAsk();
 	}
 
-	for (disk = 0; disk < gBIOCount; ++disk) {
-		if (EfiIsPartition(gBIOHandles[disk])) continue;
-		io = EfiGetBlockIO(gBIOHandles[disk]);
-		if (io == NULL) continue;
-		res = io->ReadBlocks(io, io->Media->MediaId, 62, 512, Header);
-		if (EFI_ERROR(res)) continue;
+	// Headers of all disks are tried at once
+	res = DiskProbeAll();
+	if (EFI_ERROR(res)) return res;
+	headers = MEM_ALLOC(sizeof(CHAR8*) * gDiskProbesCount);
+	disks = MEM_ALLOC(sizeof(UINTN) * gDiskProbesCount);
+	if (headers == NULL || disks == NULL) {
+		MEM_FREE(headers);
+		MEM_FREE(disks);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	for (disk = 0; disk < gDiskProbesCount; ++disk) {
+		if (EFI_ERROR(gDiskProbes[disk].HeaderStatus)) continue;
 		BioPrintDevicePath(disk);
-		res = TryHeaderDecrypt(Header, &gAuthCryptInfo, &gHeaderCryptInfo);
-		if (EFI_ERROR(res)) continue;
-		doDecrypt = TRUE;
-		break;
+		OUT_PRINT(L"\n");
+		headers[count] = (CHAR8*)gDiskProbes[disk].Header;
+		disks[count] = disk;
+		count++;
 	}
+	if (count > 0) {
+		res = TryHeadersDecrypt(headers, count, &found, &gAuthCryptInfo, &gHeaderCryptInfo);
+		if (!EFI_ERROR(res)) {
+			disk = disks[found];
+			CopyMem(Header, headers[found], 512);
+			OUT_PRINT(L"Found on ");
+			BioPrintDevicePath(disk);
+			OUT_PRINT(L"\n");
+			doDecrypt = TRUE;
+		}
+	}
+	MEM_FREE(headers);
+	MEM_FREE(disks);
 
 	if (doDecrypt) {
 		if (!AskConfirm("Decrypt?", 1)) {
@@ -938,7 +1485,6 @@ OSBackupKeyLoad(
 	UINTN                   restoreDataSize;
 	UINTN                   disk;
 	UINTN                   diskOS;
-	EFI_BLOCK_IO_PROTOCOL*  io;
 	UINT64                  startUnit = 0;
 	INTN                    deListHdrIdOk;
 
@@ -1002,20 +1548,14 @@ OSBackupKeyLoad(
 
 	// Search and list all disks
 	diskOS = 999;
-	for (disk = 0; disk < gBIOCount; ++disk) {
-		if (EfiIsPartition(gBIOHandles[disk])) continue;
-		io = EfiGetBlockIO(gBIOHandles[disk]);
-		if (io == NULL) continue;
-		res = io->ReadBlocks(io, io->Media->MediaId, 0, 512, Header);
-		if (EFI_ERROR(res)) continue;
+	DiskProbeAll();
+	for (disk = 0; disk < gDiskProbesCount; ++disk) {
+		if (EFI_ERROR(gDiskProbes[disk].Status)) continue;
 		BioPrintDevicePath(disk);
-		if (DeDiskId.MbrID == *(uint32 *)(Header + 0x1b8)) {
-			res = io->ReadBlocks(io, io->Media->MediaId, 1, 512, Header);
-			if (EFI_ERROR(res)) continue;
-			if (CompareMem(&DeDiskId.GptID, &((EFI_PARTITION_TABLE_HEADER*)Header)->DiskGUID, sizeof(DeDiskId.GptID)) == 0) {
-				diskOS = disk;
-				OUT_PRINT(L"%H[found]%N");
-			}
+		if (DeDiskId.MbrID == gDiskProbes[disk].MbrId &&
+			CompareMem(&DeDiskId.GptID, &gDiskProbes[disk].GptId, sizeof(DeDiskId.GptID)) == 0) {
+			diskOS = disk;
+			OUT_PRINT(L"%H[found]%N");
 		}
 		OUT_PRINT(L"\n");
 	}
@@ -1072,6 +1612,162 @@ error:
 //////////////////////////////////////////////////////////////////////////
 // Wipe
 //////////////////////////////////////////////////////////////////////////
+// Wipe data is keystream: zero sectors encrypted by AES-XTS with random key
+// per run (key from DCS_RND), tweak is LBA. Keystream is generated on all
+// processors and overlapped with writes of previous chunks.
+typedef struct _WIPE_KEYSTREAM {
+	PCRYPTO_INFO  Info;
+} WIPE_KEYSTREAM;
+
+EFI_STATUS
+WipeKeystreamOpen(
+	OUT WIPE_KEYSTREAM  *ks
+	)
+{
+	UINT8  key[MASTER_KEYDATA_SIZE];
+	int    keySize;
+	EFI_STATUS res = EFI_SUCCESS;
+
+	ks->Info = crypto_open();
+	if (ks->Info == NULL) return EFI_BUFFER_TOO_SMALL;
+	ks->Info->ea = EAGetFirst();
+	ks->Info->mode = XTS;
+	keySize = EAGetKeySize(ks->Info->ea);
+	if (!RandgetBytes(key, keySize * 2, FALSE)) {
+		res = EFI_CRC_ERROR;
+	}	else if (EAInit(ks->Info->ea, key, ks->Info->ks) != ERR_SUCCESS ||
+		!EAInitMode(ks->Info, key + keySize)) {
+		res = EFI_INVALID_PARAMETER;
+	}
+	MEM_BURN(key, sizeof(key));
+	if (EFI_ERROR(res)) {
+		crypto_close(ks->Info);
+		ks->Info = NULL;
+	}
+	return res;
+}
+
+VOID
+WipeKeystreamClose(
+	IN OUT WIPE_KEYSTREAM  *ks
+	)
+{
+	if (ks->Info != NULL) {
+		crypto_close(ks->Info);
+		ks->Info = NULL;
+	}
+}
+
+/**
+Write keystream to sectors [start, start + count). Progress is printed if
+progress is TRUE.
+**/
+EFI_STATUS
+RangeWipe(
+	IN EFI_HANDLE h,
+	IN UINT64     start,
+	IN UINT64     count,
+	IN BOOLEAN    progress
+	)
+{
+	EFI_STATUS              res;
+	EFI_BLOCK_IO_PROTOCOL*  io;
+	EFI_BLOCK_IO2_PROTOCOL* io2 = NULL;
+	RANGE_CRYPT_IO_PARAMS   ioParams;
+	RANGE_CRYPT_SLOT        slots[CRYPT_BUF_COUNT_MAX];
+	RANGE_CRYPT_SLOT*       slot;
+	WIPE_KEYSTREAM          ks;
+	UINTN                   bufCount = 0;
+	UINTN                   maxCount;
+	UINTN                   n = 0;
+	UINTN                   i;
+	UINT64                  pos = start;
+	UINT64                  remains = count;
+
+	if (count == 0) return EFI_SUCCESS;
+	io = EfiGetBlockIO(h);
+	if (io == NULL) {
+		ERR_PRINT(L"No block device");
+		return EFI_NOT_FOUND;
+	}
+	res = WipeKeystreamOpen(&ks);
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"No randoms. %r\n", res);
+		return res;
+	}
+
+	ZeroMem(slots, sizeof(slots));
+	RangeCryptIoParamsInit(io, &ioParams);
+	if (ioParams.ChunkSectors > count) ioParams.ChunkSectors = (UINTN)count;
+	if (!EFI_ERROR(gBS->HandleProtocol(h, &gEfiBlockIo2ProtocolGuid, (VOID**)&io2))) {
+		maxCount = (gCryptBufCount > CRYPT_BUF_COUNT_MAX) ? CRYPT_BUF_COUNT_MAX : gCryptBufCount;
+		if (maxCount < 2) maxCount = 2;
+	}	else {
+		io2 = NULL;
+		maxCount = 1;
+	}
+	for (bufCount = 0; bufCount < maxCount; ++bufCount) {
+		slots[bufCount].Buf = RangeCryptBufAlloc(ioParams.ChunkSectors, ioParams.BufAlign);
+		if (slots[bufCount].Buf == NULL) break;
+		slots[bufCount].BufSectors = ioParams.ChunkSectors;
+		if (io2 != NULL && EFI_ERROR(gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &slots[bufCount].Token.Event))) {
+			slots[bufCount].Token.Event = NULL;
+		}
+	}
+	if (bufCount == 0) {
+		ERR_PRINT(L"can not get buffer\n");
+		res = EFI_BUFFER_TOO_SMALL;
+		goto error;
+	}
+
+	gScndTotal = 0;
+	gScndCurrent = 0;
+	while (remains > 0) {
+		slot = &slots[n % bufCount];
+		// Slot is free after write of previous chunk
+		res = RangeCryptSlotWait(slot);
+		if (EFI_ERROR(res)) {
+			ERR_PRINT(L"Write error: %r\n", res);
+			goto error;
+		}
+		slot->Pos = pos;
+		slot->Count = RangeCryptChunk(&ioParams, pos, remains, TRUE);
+		ZeroMem(slot->Buf, slot->Count << 9);
+		CryptDataUnitsMp(slot->Buf, slot->Pos, slot->Count, ks.Info, TRUE);
+		RangeCryptSlotIo(io, io2, slot, TRUE, TRUE);
+		if (EFI_ERROR(slot->Status)) {
+			res = slot->Status;
+			ERR_PRINT(L"Write error: %r\n", res);
+			goto error;
+		}
+		pos += slot->Count;
+		remains -= slot->Count;
+		n++;
+		if (progress) {
+			RangeCryptProgress(count, remains, pos, count);
+		}
+	}
+	for (i = 0; i < bufCount; ++i) {
+		res = RangeCryptSlotWait(&slots[i]);
+		if (EFI_ERROR(res)) {
+			ERR_PRINT(L"Write error: %r\n", res);
+			goto error;
+		}
+	}
+	io->FlushBlocks(io);
+
+error:
+	for (i = 0; i < bufCount; ++i) {
+		RangeCryptSlotWait(&slots[i]);
+		if (slots[i].Token.Event != NULL) {
+			gBS->CloseEvent(slots[i].Token.Event);
+		}
+		RangeCryptBufFree(slots[i].Buf, slots[i].BufSectors);
+	}
+	WipeKeystreamClose(&ks);
+	return res;
+}
+
 EFI_STATUS
 BlockRangeWipe(
 	IN EFI_HANDLE h,
@@ -1081,10 +1777,6 @@ BlockRangeWipe(
 {
 	EFI_STATUS              res;
 	EFI_BLOCK_IO_PROTOCOL*  bio;
-	VOID*                   buf;
-	UINT64                  remains;
-	UINT64                  pos;
-	UINTN                   rd;
 	bio = EfiGetBlockIO(h);
 	if (bio == 0) {
 		ERR_PRINT(L"No block device");
@@ -1101,37 +1793,16 @@ BlockRangeWipe(
 
 	OUT_PRINT(L"\nSectors [%lld, %lld]", start, end);
 	if (AskConfirm(", Wipe data?", 1) == 0) return EFI_NOT_READY;
-	buf = MEM_ALLOC(CRYPT_BUF_SECTORS << 9);
-	if (!buf) {
-		ERR_PRINT(L"can not get buffer\n");
-		return EFI_INVALID_PARAMETER;
+	res = RangeWipe(h, start, end - start + 1, TRUE);
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"\nWipe stopped.\n");
+		return res;
 	}
-	remains = end -start + 1;
-	pos = start;
-	do {
-		rd = (UINTN)((remains > CRYPT_BUF_SECTORS) ? CRYPT_BUF_SECTORS : remains);
-
-		if (!RandgetBytes(buf, (UINT32)(rd << 9), FALSE)) {
-			ERR_PRINT(L"No randoms. Wipe stopped.\n");
-			res = EFI_CRC_ERROR;
-			MEM_FREE(buf);
-			return res;
-		}	
-		res = bio->WriteBlocks(bio, bio->Media->MediaId, pos, rd << 9, buf);
-		if (EFI_ERROR(res)) {
-			ERR_PRINT(L"Write error: %r\n", res);
-			MEM_FREE(buf);
-			return res;
-		}
-		pos += rd;
-		remains -= rd;
-		OUT_PRINT(L"%lld %lld       \r", pos, remains);
-	} while (remains > 0);
-	OUT_PRINT(L"\nDone\n", pos, remains);
-	MEM_FREE(buf);
+	OUT_PRINT(L"\nDone\n");
 	return res;
 }
 
+//////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 // DCS authorization check
 //////////////////////////////////////////////////////////////////////////
@@ -1783,131 +2454,253 @@ SecRegionMark()
 	return res;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Security region I/O
+//////////////////////////////////////////////////////////////////////////
+// Whole region (mark in sector 61 and zones from sector 62) is read and
+// written as one transfer. Dump is one container file: header with mark
+// and index of items (zone or EFI tables spanning several zones), then
+// all zones as one stream.
+#define SEC_REGION_ZONE_SIZE   (128 * 1024)
+#define SEC_REGION_DUMP_SIGN   SIGNATURE_64('D','C','S','S','R','D','M','P')
+
+#pragma pack(1)
+typedef struct _SEC_REGION_DUMP_ITEM {
+	UINT32  Zone;        // first zone
+	UINT32  Zones;       // zones in item
+	UINT32  Crc;         // CRC32 of item data
+	UINT32  Reserved;
+} SEC_REGION_DUMP_ITEM;
+
+typedef struct _SEC_REGION_DUMP_HEADER {
+	UINT64                Signature;
+	UINT32                HeaderCrc;   // CRC32 of header and items (HeaderCrc = 0)
+	UINT32                HeaderSize;  // header and items, data starts at next 512 boundary
+	UINT32                Zones;
+	UINT32                Count;
+	UINT8                 Mark[512];
+	SEC_REGION_DUMP_ITEM  Items[0];
+} SEC_REGION_DUMP_HEADER;
+#pragma pack()
+
+/**
+Read mark and all zones. Buffer is mark (512 bytes) followed by zones.
+**/
 EFI_STATUS
-SecRegionWipe()
+SecRegionRead(
+	IN  EFI_BLOCK_IO_PROTOCOL*  bio,
+	OUT UINT8                   **region,
+	OUT UINTN                   *zones
+	)
 {
-	EFI_STATUS  res;
-	CHAR8*      buf;
-	UINTN       i;
-	EFI_BLOCK_IO_PROTOCOL* bio;
+	EFI_STATUS              res;
+	DCS_AUTH_DATA_MARK      adm[512 / sizeof(DCS_AUTH_DATA_MARK)];
+	UINT32                  crc;
+	UINT8*                  buf;
 
-	buf = MEM_ALLOC(128 * 1024);
-	if (buf == NULL) {
-		ERR_PRINT(L"no memory\n");
-		return EFI_BUFFER_TOO_SMALL;
+	res = bio->ReadBlocks(bio, bio->Media->MediaId, 61, 512, adm);
+	if (EFI_ERROR(res)) return res;
+	res = gBS->CalculateCrc32(&adm->PlatformCrc, sizeof(*adm) - 4, &crc);
+	if (EFI_ERROR(res)) return res;
+	if (adm->HeaderCrc != crc || adm->AuthDataSize == 0) {
+		return EFI_CRC_ERROR;
+	}
+	buf = MEM_ALLOC(512 + (UINTN)adm->AuthDataSize * SEC_REGION_ZONE_SIZE);
+	if (buf == NULL) return EFI_BUFFER_TOO_SMALL;
+	CopyMem(buf, adm, 512);
+	res = bio->ReadBlocks(bio, bio->Media->MediaId, 62, (UINTN)adm->AuthDataSize * SEC_REGION_ZONE_SIZE, buf + 512);
+	if (EFI_ERROR(res)) {
+		MEM_FREE(buf);
+		return res;
 	}
+	*region = buf;
+	*zones = adm->AuthDataSize;
+	return EFI_SUCCESS;
+}
 
-	bio = EfiGetBlockIO(gBIOHandles[BioIndexStart]);
+/**
+Write mark and zones (buffer as SecRegionRead returns) in one transfer
+**/
+EFI_STATUS
+SecRegionWrite(
+	IN  EFI_BLOCK_IO_PROTOCOL*  bio,
+	IN  UINT8                   *region,
+	IN  UINTN                   zones
+	)
+{
+	EFI_STATUS res;
+	res = bio->WriteBlocks(bio, bio->Media->MediaId, 61, 512 + zones * SEC_REGION_ZONE_SIZE, region);
+	if (EFI_ERROR(res)) return res;
+	return bio->FlushBlocks(bio);
+}
+
+EFI_STATUS
+SecRegionWipe()
+{
+	// Mark and region
+	return RangeWipe(gBIOHandles[BioIndexStart], 61, 1 + gSecRigonCount * (SEC_REGION_ZONE_SIZE / 512), FALSE);
+}
+
+EFI_STATUS
+SecRegionDump(
+	IN EFI_HANDLE   hBio,
+	IN CHAR16       *fileName
+	)
+{
+	EFI_STATUS              res = EFI_SUCCESS;
+	EFI_BLOCK_IO_PROTOCOL*  bio;
+	UINT8*                  region = NULL;
+	UINTN                   zones = 0;
+	UINT8*                  data;
+	SEC_REGION_DUMP_HEADER* hdr = NULL;
+	UINTN                   hdrSize;
+	UINTN                   offset = 0;
+	UINTN                   saveSize = 0;
+	EFI_FILE*               file = NULL;
+
+	bio = EfiGetBlockIO(hBio);
 	if (bio == NULL) {
 		ERR_PRINT(L"No block IO");
-		res = EFI_ACCESS_DENIED;
-		goto error;
+		return EFI_ACCESS_DENIED;
 	}
 
-	if (!RandgetBytes(buf, 512, FALSE)) {
-		ERR_PRINT(L"No randoms\n");
-		res = EFI_CRC_ERROR;
-		goto error;
-	}	
-	
-	// Wipe mark
-	res = bio->WriteBlocks(bio, bio->Media->MediaId, 61, 512, buf);
-	if (EFI_ERROR(res)) {
-		ERR_PRINT(L"Write: %r\n", res);
-		goto error;
+	CE(SecRegionRead(bio, &region, &zones));
+	data = region + 512;
+
+	hdrSize = sizeof(*hdr) + zones * sizeof(SEC_REGION_DUMP_ITEM);
+	hdrSize = (hdrSize + 511) & ~((UINTN)511);
+	hdr = MEM_ALLOC(hdrSize);
+	if (hdr == NULL) {
+		res = EFI_BUFFER_TOO_SMALL;
+		goto err;
 	}
+	hdr->Signature = SEC_REGION_DUMP_SIGN;
+	hdr->Zones = (UINT32)zones;
+	CopyMem(hdr->Mark, region, 512);
 
-	// Wipe region
-	for (i = 0; i < gSecRigonCount; ++i) {
-		if (!RandgetBytes(buf, 128 * 1024, FALSE)) {
-			ERR_PRINT(L"No randoms\n");
-			res = EFI_CRC_ERROR;
-			goto error;
-		}
-		res = bio->WriteBlocks(bio, bio->Media->MediaId, 62 + i * (128 * 1024 / 512), 128 * 1024, buf);
-		if (EFI_ERROR(res)) {
-			ERR_PRINT(L"Write: %r\n", res);
-			goto error;
+	// Index
+	do {
+		SEC_REGION_DUMP_ITEM* item = &hdr->Items[hdr->Count];
+		// EFI tables?
+		if (TablesVerify(zones * SEC_REGION_ZONE_SIZE - offset, data + offset)) {
+			EFI_TABLE_HEADER *mhdr = (EFI_TABLE_HEADER *)(data + offset);
+			saveSize = ((mhdr->HeaderSize + SEC_REGION_ZONE_SIZE - 1) / SEC_REGION_ZONE_SIZE) * SEC_REGION_ZONE_SIZE;
+		}	else {
+			saveSize = SEC_REGION_ZONE_SIZE;
 		}
-	}
-	return EFI_SUCCESS;
+		item->Zone = (UINT32)(offset / SEC_REGION_ZONE_SIZE);
+		item->Zones = (UINT32)(saveSize / SEC_REGION_ZONE_SIZE);
+		CE(gBS->CalculateCrc32(data + offset, saveSize, &item->Crc));
+		OUT_PRINT(L"%d: zone %d (%d)\n", hdr->Count, item->Zone, item->Zones);
+		hdr->Count++;
+		offset += saveSize;
+	} while (offset < zones * SEC_REGION_ZONE_SIZE);
+	hdr->HeaderSize = (UINT32)(sizeof(*hdr) + hdr->Count * sizeof(SEC_REGION_DUMP_ITEM));
+	CE(gBS->CalculateCrc32(hdr, hdr->HeaderSize, &hdr->HeaderCrc));
+
+	// Header and zones as one stream
+	FileDelete(NULL, fileName);
+	CE(FileOpen(NULL, fileName, &file, EFI_FILE_MODE_READ | EFI_FILE_MODE_CREATE | EFI_FILE_MODE_WRITE, 0));
+	CE(FileWrite(file, hdr, hdrSize, NULL));
+	CE(FileWrite(file, data, zones * SEC_REGION_ZONE_SIZE, NULL));
+	OUT_PRINT(L"%s saved\n", fileName);
 
-error:
-	MEM_FREE(buf);
+err:
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"%r\n", res);
+	}
+	if (file != NULL) FileClose(file);
+	if (region != NULL) {
+		MEM_BURN(region, 512 + zones * SEC_REGION_ZONE_SIZE);
+		MEM_FREE(region);
+	}
+	MEM_FREE(hdr);
 	return res;
 }
 
 EFI_STATUS
-SecRegionDump(
+SecRegionRestore(
 	IN EFI_HANDLE   hBio,
-	IN CHAR16       *prefix
+	IN CHAR16       *fileName
 	)
 {
 	EFI_STATUS              res = EFI_SUCCESS;
 	EFI_BLOCK_IO_PROTOCOL*  bio;
-	DCS_AUTH_DATA_MARK*     adm = NULL;
+	UINT8*                  fileData = NULL;
+	UINTN                   fileSize = 0;
+	SEC_REGION_DUMP_HEADER* hdr;
+	UINT8*                  region = NULL;
+	UINTN                   dataOffset;
+	UINTN                   zones = 0;
+	UINTN                   i;
 	UINT32                  crc;
-	UINT8*                  SecRegionDumpData = NULL;
-	UINTN                   SecRegionDumpSize = 0;
-	UINTN                   SecRegionDumpOffset = 0;
-	UINTN                   saveSize = 0;
-	UINTN                   idx = 0;
-	CHAR16                  name[128];
-
-	adm = (DCS_AUTH_DATA_MARK*)MEM_ALLOC(512);
-	if (adm == NULL) {
-		ERR_PRINT(L"no memory\n");
-		return EFI_BUFFER_TOO_SMALL;
-	}
+	UINT32                  crcSaved;
 
 	bio = EfiGetBlockIO(hBio);
 	if (bio == NULL) {
 		ERR_PRINT(L"No block IO");
-		res = EFI_ACCESS_DENIED;
-		goto err;
+		return EFI_ACCESS_DENIED;
 	}
 
-	CE(bio->ReadBlocks(bio, bio->Media->MediaId, 61, 512, adm));
-	CE(gBS->CalculateCrc32(&adm->PlatformCrc, sizeof(*adm) - 4, &crc));
-
-	if (adm->HeaderCrc != crc) {
-		res = EFI_INVALID_PARAMETER;
+	CE(FileLoad(NULL, fileName, &fileData, &fileSize));
+	hdr = (SEC_REGION_DUMP_HEADER*)fileData;
+	res = EFI_CRC_ERROR;
+	if (fileSize < sizeof(*hdr) || hdr->Signature != SEC_REGION_DUMP_SIGN ||
+		hdr->HeaderSize < sizeof(*hdr) || hdr->HeaderSize > fileSize ||
+		hdr->Count > hdr->Zones ||
+		hdr->HeaderSize != sizeof(*hdr) + hdr->Count * sizeof(SEC_REGION_DUMP_ITEM)) {
+		goto err;
+	}
+	crcSaved = hdr->HeaderCrc;
+	hdr->HeaderCrc = 0;
+	CE(gBS->CalculateCrc32(hdr, hdr->HeaderSize, &crc));
+	hdr->HeaderCrc = crcSaved;
+	res = EFI_CRC_ERROR;
+	zones = hdr->Zones;
+	dataOffset = (hdr->HeaderSize + 511) & ~((UINTN)511);
+	if (crc != crcSaved || fileSize != dataOffset + zones * SEC_REGION_ZONE_SIZE) {
+		goto err;
+	}
+	for (i = 0; i < hdr->Count; ++i) {
+		SEC_REGION_DUMP_ITEM* item = &hdr->Items[i];
+		if ((UINTN)item->Zone + item->Zones > zones || item->Zones == 0) goto err;
+		CE(gBS->CalculateCrc32(fileData + dataOffset + (UINTN)item->Zone * SEC_REGION_ZONE_SIZE, (UINTN)item->Zones * SEC_REGION_ZONE_SIZE, &crc));
+		res = EFI_CRC_ERROR;
+		if (crc != item->Crc) goto err;
 	}
 
-	SecRegionDumpSize = adm->AuthDataSize * 128 * 1024;
-	SecRegionDumpData = MEM_ALLOC(SecRegionDumpSize);
-	if (SecRegionDumpData == NULL) {
+	region = MEM_ALLOC(512 + zones * SEC_REGION_ZONE_SIZE);
+	if (region == NULL) {
 		res = EFI_BUFFER_TOO_SMALL;
 		goto err;
 	}
-	CE(bio->ReadBlocks(bio, bio->Media->MediaId, 62, SecRegionDumpSize, SecRegionDumpData));
-
-	do {
-		// EFI tables?
-		if (TablesVerify(SecRegionDumpSize - SecRegionDumpOffset, SecRegionDumpData + SecRegionDumpOffset)) {
-			EFI_TABLE_HEADER *mhdr = (EFI_TABLE_HEADER *)(SecRegionDumpData + SecRegionDumpOffset);
-			UINTN tblZones = (mhdr->HeaderSize + 1024 * 128 - 1) / (1024 * 128);
-			saveSize = tblZones * 1024 * 128;
-		}		else {
-			saveSize = 1024 * 128;
-		}
-		UnicodeSPrint(name, sizeof(name), L"%s%d", prefix, idx);
-		CE(FileSave(NULL, name, SecRegionDumpData + SecRegionDumpOffset, saveSize));
-		OUT_PRINT(L"%s saved\n", name);
-		idx += saveSize / (1024 * 128);
-		SecRegionDumpOffset += saveSize;
-	} while (SecRegionDumpOffset < SecRegionDumpSize);
+	CopyMem(region, hdr->Mark, 512);
+	CopyMem(region + 512, fileData + dataOffset, zones * SEC_REGION_ZONE_SIZE);
+	OUT_PRINT(L"Target ");
+	EfiPrintDevicePath(hBio);
+	OUT_PRINT(L"\nSector 61 and %d zones will be overwritten\n", zones);
+	if (!AskConfirm("Restore?", 1)) {
+		res = EFI_NOT_READY;
+		goto err;
+	}
+	CE(SecRegionWrite(bio, region, zones));
+	OUT_PRINT(L"%s restored, %d zones\n", fileName, zones);
 
 err:
 	if (EFI_ERROR(res)) {
 		ERR_PRINT(L"%r\n", res);
 	}
-	MEM_FREE(adm);
-	MEM_FREE(SecRegionDumpData);
+	if (fileData != NULL) {
+		MEM_BURN(fileData, fileSize);
+		MEM_FREE(fileData);
+	}
+	if (region != NULL) {
+		MEM_BURN(region, 512 + zones * SEC_REGION_ZONE_SIZE);
+		MEM_FREE(region);
+	}
 	return res;
 }
 
-
 EFI_STATUS
 SecRegionAdd(
 	IN UINTN       regIdx
@@ -2054,3 +2847,244 @@ GptEdit(
 	GptSyncMainAlt();
 	return EFI_SUCCESS;
 }
+
+//////////////////////////////////////////////////////////////////////////
+// Benchmark
+//////////////////////////////////////////////////////////////////////////
+// Ciphers are timed in XTS mode on all processors (as RangeCrypt does).
+// PRFs are timed by header key derivation with wrong password at several
+// PIMs. Time is linear in PRF cost (iterations * memory cost), so PIM for
+// target unlock time is estimated from the lowest and highest cost measured.
+#define BENCH_BUF_SECTORS   (CRYPT_MP_SLICE_SECTORS * 4)
+#define BENCH_MIN_US        250000
+#define BENCH_PIM_MAX       10000
+#define BENCH_PIMS_COUNT    3
+
+CHAR16*  gBenchFileName = L"EFI\\VeraCrypt\\Benchmark";
+int      gBenchPims[BENCH_PIMS_COUNT] = { 1, 5, 0 };
+
+UINT64
+BenchPrfCost(
+	IN int prf,
+	IN int pim
+	)
+{
+	int    memoryCost = 0;
+	UINT64 cost;
+	cost = (UINT64)get_pkcs5_iteration_count(prf, pim, gAuthBoot, &memoryCost);
+	if (memoryCost > 0) cost *= (UINT64)memoryCost;
+	return cost;
+}
+
+UINT64
+BenchMBps(
+	IN UINT64 bytes,
+	IN UINT64 us
+	)
+{
+	if (us == 0) return 0;
+	return (bytes * 1000000 / us) >> 20;
+}
+
+EFI_STATUS
+BenchCipher(
+	IN  int      ea,
+	IN  UINT8    *buf,
+	OUT UINT64   *bytes,
+	OUT UINT64   *encUs,
+	OUT UINT64   *decUs
+	)
+{
+	PCRYPTO_INFO info;
+	UINT8        key[MASTER_KEYDATA_SIZE];
+	int          keySize;
+	UINTN        i;
+	UINTN        runs = 0;
+	UINT64       start;
+	EFI_STATUS   res = EFI_SUCCESS;
+
+	info = crypto_open();
+	if (info == NULL) return EFI_BUFFER_TOO_SMALL;
+	info->ea = ea;
+	info->mode = XTS;
+	keySize = EAGetKeySize(ea);
+	// Key value does not matter for speed
+	for (i = 0; i < sizeof(key); ++i) key[i] = (UINT8)(i * 7 + ea);
+	if (EAInit(ea, key, info->ks) != ERR_SUCCESS || !EAInitMode(info, key + keySize)) {
+		res = EFI_INVALID_PARAMETER;
+		goto err;
+	}
+
+	start = TimerTicks();
+	do {
+		CryptDataUnitsMp(buf, runs * BENCH_BUF_SECTORS, BENCH_BUF_SECTORS, info, TRUE);
+		runs++;
+		*encUs = TimerElapsedUs(start);
+	} while (*encUs < BENCH_MIN_US);
+
+	start = TimerTicks();
+	for (i = 0; i < runs; ++i) {
+		CryptDataUnitsMp(buf, i * BENCH_BUF_SECTORS, BENCH_BUF_SECTORS, info, FALSE);
+	}
+	*decUs = TimerElapsedUs(start);
+	*bytes = (UINT64)runs * BENCH_BUF_SECTORS * 512;
+
+err:
+	MEM_BURN(key, sizeof(key));
+	crypto_close(info);
+	return res;
+}
+
+UINT64
+BenchPrf(
+	IN int prf,
+	IN int pim
+	)
+{
+	Password      pwd;
+	char          header[TC_VOLUME_HEADER_EFFECTIVE_SIZE];
+	PCRYPTO_INFO  info = NULL;
+	UINTN         i;
+	UINT64        start;
+	UINT64        us;
+
+	ZeroMem(&pwd, sizeof(pwd));
+	pwd.Length = 8;
+	CopyMem(pwd.Text, "DcsBench", 8);
+	for (i = 0; i < sizeof(header); ++i) header[i] = (char)(i * 13 + 1);
+	start = TimerTicks();
+	if (ReadVolumeHeader(gAuthBoot, header, &pwd, prf, pim, &info, NULL) == 0 && info != NULL) {
+		crypto_close(info);
+	}
+	us = TimerElapsedUs(start);
+	return us;
+}
+
+/**
+Largest PIM with estimated unlock time not longer than targetUs (1 if even
+PIM 1 is slower). Time is interpolated from (cost0, us0) and (cost1, us1).
+**/
+int
+BenchPimForTarget(
+	IN  int      prf,
+	IN  UINT64   cost0,
+	IN  UINT64   us0,
+	IN  UINT64   cost1,
+	IN  UINT64   us1,
+	IN  UINT64   targetUs,
+	OUT UINT64   *estUs
+	)
+{
+	int    pim;
+	int    best = 1;
+	UINT64 cost;
+	UINT64 us;
+
+	*estUs = us0;
+	if (cost1 <= cost0 || us1 <= us0) return 0;
+	for (pim = 1; pim <= BENCH_PIM_MAX; ++pim) {
+		cost = BenchPrfCost(prf, pim);
+		us = (cost >= cost0) ? us0 + (us1 - us0) * (cost - cost0) / (cost1 - cost0) : us0 * cost / cost0;
+		if (pim != 1 && us > targetUs) break;
+		best = pim;
+		*estUs = us;
+	}
+	return best;
+}
+
+EFI_STATUS
+CryptBenchmark(
+	IN UINTN targetMs
+	)
+{
+	EFI_STATUS    res = EFI_SUCCESS;
+	UINT8         *buf = NULL;
+	EFI_FILE      *f = NULL;
+	CHAR16        name[128];
+	int           ea;
+	int           prf;
+	UINTN         i;
+	UINTN         lo;
+	UINTN         hi;
+	UINT64        bytes;
+	UINT64        encUs;
+	UINT64        decUs;
+	UINT64        us[BENCH_PIMS_COUNT];
+	UINT64        cost[BENCH_PIMS_COUNT];
+	UINT64        estUs;
+	int           pim;
+
+	if (targetMs == 0) targetMs = 2000;
+	// Calibration stall must not be inside measured loops
+	if (gTimerTicksPerMs == 0) InitTimer();
+	buf = MEM_ALLOC(BENCH_BUF_SECTORS * 512);
+	if (buf == NULL) return EFI_BUFFER_TOO_SMALL;
+	for (i = 0; i < BENCH_BUF_SECTORS * 512; ++i) buf[i] = (UINT8)i;
+
+	// XML export next to PlatformInfo of DcsInfo
+	FileDelete(NULL, gBenchFileName);
+	if (EFI_ERROR(FileOpen(NULL, gBenchFileName, &f, EFI_FILE_MODE_READ | EFI_FILE_MODE_CREATE | EFI_FILE_MODE_WRITE, 0))) {
+		ERR_PRINT(L"%s create failed\n", gBenchFileName);
+		f = NULL;
+	}
+	if (f != NULL) {
+		FileAsciiPrint(f, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+		FileAsciiPrint(f, "<Benchmark cpus=\"%d\" boot=\"%d\" target_ms=\"%d\">\n", gMpCpuCount, gAuthBoot, targetMs);
+	}
+
+	OUT_PRINT(L"%HCiphers%N (XTS, %d CPUs) MB/s encrypt/decrypt\n", gMpCpuCount);
+	for (ea = EAGetFirst(); ea != 0; ea = EAGetNext(ea)) {
+		EAGetName(name, 128, ea, 1);
+		res = BenchCipher(ea, buf, &bytes, &encUs, &decUs);
+		if (EFI_ERROR(res)) {
+			ERR_PRINT(L"%s: %r\n", name, res);
+			continue;
+		}
+		OUT_PRINT(L"(%d) %-24s %6lld %6lld\n", ea, name, BenchMBps(bytes, encUs), BenchMBps(bytes, decUs));
+		if (f != NULL) {
+			FileAsciiPrint(f, "  <Cipher ea=\"%d\" name=\"%s\" mode=\"XTS\" bytes=\"%lld\" enc_us=\"%lld\" dec_us=\"%lld\" enc_mbps=\"%lld\" dec_mbps=\"%lld\"/>\n",
+				ea, name, bytes, encUs, decUs, BenchMBps(bytes, encUs), BenchMBps(bytes, decUs));
+		}
+	}
+	res = EFI_SUCCESS;
+
+	OUT_PRINT(L"%HPRFs%N (%s mode) ms for PIM", gAuthBoot ? L"boot" : L"normal");
+	for (i = 0; i < BENCH_PIMS_COUNT; ++i) {
+		OUT_PRINT(L" %d", gBenchPims[i]);
+	}
+	OUT_PRINT(L", PIM for %d ms\n", targetMs);
+	for (prf = FIRST_PRF_ID; prf <= LAST_PRF_ID; ++prf) {
+		lo = 0;
+		hi = 0;
+		OUT_PRINT(L"(%d) %-12s", prf, HashGetName(prf));
+		for (i = 0; i < BENCH_PIMS_COUNT; ++i) {
+			cost[i] = BenchPrfCost(prf, gBenchPims[i]);
+			us[i] = BenchPrf(prf, gBenchPims[i]);
+			if (cost[i] < cost[lo]) lo = i;
+			if (cost[i] > cost[hi]) hi = i;
+			OUT_PRINT(L" %6lld", us[i] / 1000);
+		}
+		pim = BenchPimForTarget(prf, cost[lo], us[lo], cost[hi], us[hi], (UINT64)targetMs * 1000, &estUs);
+		if (pim != 0) {
+			OUT_PRINT(L" %HPIM %d%N (~%lld ms)%s\n", pim, estUs / 1000, prf == gAuthHash ? L" *" : L"");
+		}	else {
+			OUT_PRINT(L" -\n");
+		}
+		if (f != NULL) {
+			FileAsciiPrint(f, "  <Prf id=\"%d\" name=\"%s\" recommended_pim=\"%d\" recommended_ms=\"%lld\">\n",
+				prf, HashGetName(prf), pim, estUs / 1000);
+			for (i = 0; i < BENCH_PIMS_COUNT; ++i) {
+				FileAsciiPrint(f, "    <Pim value=\"%d\" cost=\"%lld\" us=\"%lld\"/>\n", gBenchPims[i], cost[i], us[i]);
+			}
+			FileAsciiPrint(f, "  </Prf>\n");
+		}
+	}
+
+	if (f != NULL) {
+		FileAsciiPrint(f, "</Benchmark>\n");
+		FileClose(f);
+		OUT_PRINT(L"Saved to %s\n", gBenchFileName);
+	}
+	MEM_FREE(buf);
+	return res;
+}
@@ -24,6 +24,7 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Guid/GlobalVariable.h>
 
 #include "DcsCfg.h"
+#include "DcsConfig.h"
 #include "Library/PasswordLib.h"
 
 #include "common/Tcdefs.h"
@@ -57,6 +58,10 @@ https://opensource.org/licenses/LGPL-3.0
 #define OPT_VOLUME_ENCRYPT				L"-vec"
 #define OPT_VOLUME_DECRYPT				L"-vdc"
 #define OPT_VOLUME_CHANGEPWD			L"-vcp"
+#define OPT_CRYPT_BUFFERS				L"-cbuf"
+#define OPT_CRYPT_CHECKPOINT			L"-chkpt"
+#define OPT_CRYPT_CHUNK					L"-cchunk"
+#define OPT_CRYPT_BENCH					L"-bench"
 
 #define OPT_RND							L"-rnd"
 #define OPT_RND_GEN						L"-rndgen"
@@ -83,6 +88,7 @@ https://opensource.org/licenses/LGPL-3.0
 #define OPT_SECREGION_WIPE				L"-srw"
 #define OPT_SECREGION_ADD				L"-sra"
 #define OPT_SECREGION_DUMP				L"-srdump"
+#define OPT_SECREGION_RESTORE			L"-srrestore"
 #define OPT_WIPE							L"-wipe"
 
 #define OPT_OS_DECRYPT					L"-osdecrypt"
@@ -99,12 +105,16 @@ https://opensource.org/licenses/LGPL-3.0
 #define OPT_TBL_DELETE					L"-tbd"
 #define OPT_TBL_APPEND					L"-tba"
 #define OPT_TBL_DUMP						L"-tbdump"
+#define OPT_CONFIG_BIN					L"-propbin"
+#define OPT_TRACE_PRINT					L"-trace"
 
 #define OPT_OS_HIDE_PREP					L"-oshideprep"
 
 
 STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
 	{ OPT_TBL_DUMP,      TypeValue },
+	{ OPT_CONFIG_BIN,    TypeFlag },
+	{ OPT_TRACE_PRINT,   TypeFlag },
 	{ OPT_TBL_FILE,      TypeValue },
 	{ OPT_TBL_ZERO,      TypeFlag },
 	{ OPT_TBL_LIST,      TypeFlag },
@@ -125,6 +135,10 @@ STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
 	{ OPT_VOLUME_ENCRYPT,TypeValue },
    { OPT_VOLUME_DECRYPT,TypeValue },
 	{ OPT_VOLUME_CHANGEPWD,TypeValue },
+	{ OPT_CRYPT_BUFFERS, TypeValue },
+	{ OPT_CRYPT_CHECKPOINT, TypeDoubleValue },
+	{ OPT_CRYPT_CHUNK,   TypeValue },
+	{ OPT_CRYPT_BENCH,   TypeValue },
 	{ OPT_USB_LIST,      TypeFlag },
 	{ OPT_USB_SELECT,    TypeValue },
 	{ OPT_SC_APDU,       TypeValue },
@@ -155,6 +169,7 @@ STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
 	{ OPT_SECREGION_WIPE,       TypeValue },
 	{ OPT_SECREGION_ADD,        TypeValue },
 	{ OPT_SECREGION_DUMP,       TypeValue },
+	{ OPT_SECREGION_RESTORE,    TypeValue },
 	{ OPT_WIPE,                 TypeDoubleValue },
 	{ OPT_OS_DECRYPT,     TypeFlag },
 	{ OPT_OS_RESTORE_KEY, TypeFlag },
@@ -166,18 +181,10 @@ STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
 };
 
 /**
-The actual entry point for the application.
-
-@param[in] ImageHandle    The firmware allocated handle for the EFI image.
-@param[in] SystemTable    A pointer to the EFI System Table.
-
-@retval EFI_SUCCESS       The entry point executed successfully.
-@retval other             Some error occur when executing this entry point.
-
+Command line and interactive setup. Cleanup is done by DcsCfgMain.
 **/
 EFI_STATUS
-EFIAPI
-DcsCfgMain(
+DcsCfgRun(
    IN EFI_HANDLE        ImageHandle,
    IN EFI_SYSTEM_TABLE  *SystemTable
    )
@@ -202,6 +209,7 @@ DcsCfgMain(
 	InitBio();
 	InitFS();
 	DetectX86Features();
+	InitMp();
 
 	//
    // initialize the shell lib (we must be in non-auto-init...)
@@ -292,6 +300,37 @@ DcsCfgMain(
 		BioIndexEnd = StrDecimalToUintn(opt);
 	}
 
+	if (ShellCommandLineGetFlag(Package, OPT_CRYPT_BUFFERS)) {
+		CONST CHAR16* opt = NULL;
+		opt = ShellCommandLineGetValue(Package, OPT_CRYPT_BUFFERS);
+		gCryptBufCount = StrDecimalToUintn(opt);
+	}
+
+	if (ShellCommandLineGetFlag(Package, OPT_CRYPT_CHUNK)) {
+		CONST CHAR16* opt = NULL;
+		opt = ShellCommandLineGetValue(Package, OPT_CRYPT_CHUNK);
+		gCryptChunkKB = StrDecimalToUintn(opt);
+	}
+
+	if (ShellCommandLineGetFlag(Package, OPT_CRYPT_CHECKPOINT)) {
+		CONST CHAR16* opt = NULL;
+		CONST CHAR16* opt2 = NULL;
+		opt = ShellCommandLineGetValue(Package, OPT_CRYPT_CHECKPOINT);
+		gCryptCheckpointMB = StrDecimalToUintn(opt);
+		opt2 = StrStr(opt, L" ");
+		if (opt2 != NULL) {
+			gCryptCheckpointSeconds = StrDecimalToUintn(opt2 + 1);
+		}
+		if (gCryptCheckpointMB != 0 || gCryptCheckpointSeconds != 0) {
+			ERR_PRINT(L"Power loss between checkpoints crypts data after last checkpoint again and corrupts it\n");
+			if (!AskConfirm("Use checkpoint interval?", 1)) {
+				gCryptCheckpointMB = 0;
+				gCryptCheckpointSeconds = 0;
+				OUT_PRINT(L"Checkpoint after every chunk\n");
+			}
+		}
+	}
+
 	if (ShellCommandLineGetFlag(Package, OPT_PARTITION_FILE)) {
 		DcsDiskEntrysFileName = ShellCommandLineGetValue(Package, OPT_PARTITION_FILE);
 	}
@@ -331,10 +370,34 @@ DcsCfgMain(
 		TablesList(gDcsTablesSize, gDcsTables);
 	}
 
+	if (ShellCommandLineGetFlag(Package, OPT_CONFIG_BIN)) {
+		res = ConfigBinSave();
+		if (EFI_ERROR(res)) {
+			ERR_PRINT(L"DcsProp.bin: %r\n", res);
+		}
+	}
+
+	if (ShellCommandLineGetFlag(Package, OPT_TRACE_PRINT)) {
+		DCS_TRACE *trace = NULL;
+		res = TraceLoad(&trace);
+		if (EFI_ERROR(res)) {
+			ERR_PRINT(L"Boot trace: %r\n", res);
+		}	else {
+			TracePrint(trace);
+			MEM_FREE(trace);
+		}
+	}
+
 	if (ShellCommandLineGetFlag(Package, OPT_AUTH_ASK)) {
 		TestAuthAsk();
 	}
 
+	if (ShellCommandLineGetFlag(Package, OPT_CRYPT_BENCH)) {
+		CONST CHAR16* opt = NULL;
+		opt = ShellCommandLineGetValue(Package, OPT_CRYPT_BENCH);
+		return CryptBenchmark(opt != NULL ? StrDecimalToUintn(opt) : 0);
+	}
+
 	// Beep
 	if (ShellCommandLineGetFlag(Package, OPT_BEEP_LIST)) {
 		PrintSpeakerList();
@@ -753,6 +816,17 @@ DcsCfgMain(
 		}
 	}
 
+	if (ShellCommandLineGetFlag(Package, OPT_SECREGION_RESTORE)) {
+		if (ShellCommandLineGetFlag(Package, OPT_DISK_START)) {
+			CONST CHAR16* opt = NULL;
+			opt = ShellCommandLineGetValue(Package, OPT_SECREGION_RESTORE);
+			SecRegionRestore(gBIOHandles[BioIndexStart], (CHAR16*)opt);
+		}	else {
+			ERR_PRINT(L"Select disk");
+			return EFI_INVALID_PARAMETER;
+		}
+	}
+
 	// Encrypt, decrypt, change password
 	if (ShellCommandLineGetFlag(Package, OPT_DISK_CHECK)) {
 		DisksAuthCheck();
@@ -785,3 +859,31 @@ DcsCfgMain(
 	
    return EFI_SUCCESS;
 }
+
+/**
+The actual entry point for the application.
+
+@param[in] ImageHandle    The firmware allocated handle for the EFI image.
+@param[in] SystemTable    A pointer to the EFI System Table.
+
+@retval EFI_SUCCESS       The entry point executed successfully.
+@retval other             Some error occur when executing this entry point.
+
+**/
+EFI_STATUS
+EFIAPI
+DcsCfgMain(
+   IN EFI_HANDLE        ImageHandle,
+   IN EFI_SYSTEM_TABLE  *SystemTable
+   )
+{
+	EFI_STATUS res;
+	res = DcsCfgRun(ImageHandle, SystemTable);
+	DcsTpm2Release();
+	// Generator state (DRBG V and C) and cached HMAC key schedule
+	if (gRnd != NULL) {
+		MEM_BURN(gRnd, sizeof(*gRnd));
+	}
+	RndCacheBurn();
+	return res;
+}
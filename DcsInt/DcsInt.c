@@ -17,6 +17,8 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Library/UefiLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
 
 #include <Library/CommonLib.h>
 #include <Library/GraphLib.h>
@@ -89,6 +91,9 @@ EFI_GUID                *gRescueExecPartGuid = NULL;
 
 #define DCS_AUTH_DATA_ZONE_SIZE (128 * 1024)
 
+VOID
+ReadAheadBurn();
+
 VOID
 CleanSensitiveData(BOOLEAN bClearBootParams)
 {
@@ -99,6 +104,8 @@ CleanSensitiveData(BOOLEAN bClearBootParams)
 	if (gRnd != NULL) {
 		MEM_BURN(gRnd, sizeof(*gRnd));
 	}
+	RndCacheBurn();
+	ReadAheadBurn();
 
 	if (SecRegionData != NULL) {
 		MEM_BURN(SecRegionData, SecRegionSize);
@@ -211,6 +218,65 @@ void GetIntersection(uint64 start1, uint32 length1, uint64 start2, uint64 end2,
 		*intersectStart = start1;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Sectors index
+//////////////////////////////////////////////////////////////////////////
+// DE_Sectors entries of DeList sorted by start. Built once DeList is decrypted.
+// Overlapped entries are applied in DeList order (linear scan).
+#define DE_SECTORS_INDEX_MAX 16
+
+typedef struct _DE_SECTORS_RANGE {
+	UINT64   Start;
+	UINT64   End;
+	UINT64   Offset;
+} DE_SECTORS_RANGE;
+
+DE_SECTORS_RANGE        gDeSectors[DE_SECTORS_INDEX_MAX];
+UINTN                   gDeSectorsCount = 0;
+BOOLEAN                 gDeSectorsLinear = FALSE;
+UINT64                  gDeSectorsStart = 0;
+UINT64                  gDeSectorsEnd = 0;
+
+VOID
+DeSectorsIndexBuild()
+{
+	UINTN            i;
+	UINTN            j;
+	DE_SECTORS_RANGE range;
+
+	gDeSectorsCount = 0;
+	gDeSectorsLinear = FALSE;
+	if (DeList == NULL) return;
+	for (i = 0; i < DeList->Count; ++i) {
+		if (DeList->DE[i].Type != DE_Sectors || DeList->DE[i].Sectors.Length == 0) continue;
+		if (gDeSectorsCount == DE_SECTORS_INDEX_MAX) {
+			gDeSectorsLinear = TRUE;
+			return;
+		}
+		range.Start = DeList->DE[i].Sectors.Start;
+		range.End = DeList->DE[i].Sectors.Start + DeList->DE[i].Sectors.Length - 1;
+		range.Offset = DeList->DE[i].Sectors.Offset;
+		// insert sorted
+		for (j = gDeSectorsCount; j > 0 && gDeSectors[j - 1].Start > range.Start; --j) {
+			gDeSectors[j] = gDeSectors[j - 1];
+		}
+		gDeSectors[j] = range;
+		gDeSectorsCount++;
+	}
+	for (i = 1; i < gDeSectorsCount; ++i) {
+		if (gDeSectors[i].Start <= gDeSectors[i - 1].End) {
+			gDeSectorsLinear = TRUE;
+		}
+	}
+	if (gDeSectorsCount > 0) {
+		gDeSectorsStart = gDeSectors[0].Start;
+		gDeSectorsEnd = gDeSectors[gDeSectorsCount - 1].End;
+		for (i = 0; i < gDeSectorsCount; ++i) {
+			if (gDeSectors[i].End > gDeSectorsEnd) gDeSectorsEnd = gDeSectors[i].End;
+		}
+	}
+}
+
 VOID UpdateDataBuffer(
 	IN OUT UINT8* buf,
 	IN UINT32    bufSize,
@@ -219,7 +285,40 @@ VOID UpdateDataBuffer(
 	UINT64       intersectStart;
 	UINT32       intersectLength;
 	UINTN        i;
-	if (DeList == NULL) return;
+	UINT64       bufStart;
+	UINT64       bufEnd;
+	UINTN        lo;
+	UINTN        hi;
+	if (DeList == NULL || bufSize == 0) return;
+	if (!gDeSectorsLinear) {
+		// No overlays for most of reads
+		bufStart = sector << 9;
+		bufEnd = bufStart + bufSize - 1;
+		if (gDeSectorsCount == 0 || bufEnd < gDeSectorsStart || bufStart > gDeSectorsEnd) return;
+		// First range with End >= bufStart
+		lo = 0;
+		hi = gDeSectorsCount;
+		while (lo < hi) {
+			UINTN mid = (lo + hi) >> 1;
+			if (gDeSectors[mid].End < bufStart) lo = mid + 1;
+			else hi = mid;
+		}
+		for (i = lo; i < gDeSectorsCount && gDeSectors[i].Start <= bufEnd; ++i) {
+			GetIntersection(
+				bufStart, bufSize,
+				gDeSectors[i].Start, gDeSectors[i].End,
+				&intersectStart, &intersectLength
+				);
+			if (intersectLength != 0) {
+				CopyMem(
+					buf + (intersectStart - bufStart),
+					SecRegionData + SecRegionOffset + gDeSectors[i].Offset + (intersectStart - bufStart),
+					intersectLength
+					);
+			}
+		}
+		return;
+	}
 	for (i = 0; i < DeList->Count; ++i) {
 		if (DeList->DE[i].Type == DE_Sectors) {
 			GetIntersection(
@@ -241,6 +340,34 @@ VOID UpdateDataBuffer(
 
 }
 
+/**
+TRUE if bytes [bufStart, bufEnd] intersect any DE_Sectors entry.
+**/
+BOOLEAN
+DeSectorsIntersect(
+	IN UINT64    bufStart,
+	IN UINT64    bufEnd
+	)
+{
+	UINTN        i;
+	if (DeList == NULL) return FALSE;
+	if (!gDeSectorsLinear) {
+		if (gDeSectorsCount == 0 || bufEnd < gDeSectorsStart || bufStart > gDeSectorsEnd) return FALSE;
+		for (i = 0; i < gDeSectorsCount; ++i) {
+			if (gDeSectors[i].Start <= bufEnd && gDeSectors[i].End >= bufStart) return TRUE;
+		}
+		return FALSE;
+	}
+	for (i = 0; i < DeList->Count; ++i) {
+		if (DeList->DE[i].Type == DE_Sectors && DeList->DE[i].Sectors.Length != 0 &&
+			DeList->DE[i].Sectors.Start <= bufEnd &&
+			DeList->DE[i].Sectors.Start + DeList->DE[i].Sectors.Length - 1 >= bufStart) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // List of block I/O
 //////////////////////////////////////////////////////////////////////////
@@ -272,82 +399,399 @@ GetBlockIoByProtocol(
 	return NULL;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Write bounce buffers
+//////////////////////////////////////////////////////////////////////////
+// Encrypted data is written from buffers reserved on hook. Large writes are
+// split to DCSINT_BOUNCE_SIZE slices. Pool is used by nested write (higher TPL)
+// only if other buffer is free, else slice is allocated.
+#define DCSINT_BOUNCE_SIZE  (1024 * 1024)
+#define DCSINT_BOUNCE_COUNT 2
+
+UINT8*                  gBounceBuf[DCSINT_BOUNCE_COUNT];
+BOOLEAN                 gBounceBusy[DCSINT_BOUNCE_COUNT];
+
+EFI_STATUS
+BouncePoolInit(
+	IN UINT32 ioAlign
+	)
+{
+	UINTN   i;
+	UINTN   align = (ioAlign > EFI_PAGE_SIZE) ? ioAlign : EFI_PAGE_SIZE;
+	for (i = 0; i < DCSINT_BOUNCE_COUNT; ++i) {
+		if (gBounceBuf[i] != NULL) continue;
+		gBounceBuf[i] = AllocateAlignedPages(EFI_SIZE_TO_PAGES(DCSINT_BOUNCE_SIZE), align);
+		if (gBounceBuf[i] == NULL) return EFI_OUT_OF_RESOURCES;
+	}
+	return EFI_SUCCESS;
+}
+
+UINT8*
+BounceAcquire()
+{
+	UINTN    i;
+	UINT8*   buf = NULL;
+	EFI_TPL  tpl;
+	tpl = gBS->RaiseTPL(TPL_NOTIFY);
+	for (i = 0; i < DCSINT_BOUNCE_COUNT; ++i) {
+		if (gBounceBuf[i] != NULL && !gBounceBusy[i]) {
+			gBounceBusy[i] = TRUE;
+			buf = gBounceBuf[i];
+			break;
+		}
+	}
+	gBS->RestoreTPL(tpl);
+	if (buf == NULL) {
+		buf = MEM_ALLOC(DCSINT_BOUNCE_SIZE);
+	}
+	return buf;
+}
+
+VOID
+BounceRelease(
+	IN UINT8* buf
+	)
+{
+	UINTN    i;
+	for (i = 0; i < DCSINT_BOUNCE_COUNT; ++i) {
+		if (gBounceBuf[i] == buf) {
+			gBounceBusy[i] = FALSE;
+			return;
+		}
+	}
+	MEM_FREE(buf);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Read ahead
+//////////////////////////////////////////////////////////////////////////
+// OS loader reads encrypted area by many small sequential requests. On second
+// sequential read an aligned extent of gReadAhead KB is read and decrypted at
+// once, next small reads are copied from it. Extents intersecting DE_Sectors
+// overlays are not cached, such reads go direct. Any write to the disk drops
+// the extent.
+// Extent is burned by CleanSensitiveData and on ExitBootServices.
+#define DCSINT_RA_MAX       (4 * 1024 * 1024)
+#define DCSINT_RA_ALIGN     8
+
+UINT8*                  gRaBuf = NULL;
+UINTN                   gRaSize = 0;
+BOOLEAN                 gRaBusy = FALSE;
+BOOLEAN                 gRaDirty = FALSE;
+DCSINT_BLOCK_IO*        gRaOwner = NULL;
+UINT32                  gRaMediaId = 0;
+EFI_LBA                 gRaStart = 0;
+UINTN                   gRaCount = 0;
+EFI_LBA                 gRaNext = 0;
+EFI_EVENT               gRaExitEvent = NULL;
+
+VOID
+ReadAheadBurn()
+{
+	if (gRaBuf != NULL) {
+		MEM_BURN(gRaBuf, gRaSize);
+	}
+	gRaCount = 0;
+	gRaOwner = NULL;
+	gRaSize = 0;
+}
+
+VOID
+EFIAPI
+ReadAheadExitEvent(
+	IN EFI_EVENT        Event,
+	IN VOID             *Context
+	)
+{
+	ReadAheadBurn();
+}
+
+EFI_STATUS
+ReadAheadInit(
+	IN UINT32 ioAlign
+	)
+{
+	UINTN   size;
+	UINTN   align = (ioAlign > EFI_PAGE_SIZE) ? ioAlign : EFI_PAGE_SIZE;
+	if (gRaBuf != NULL || gReadAhead <= 0) return EFI_SUCCESS;
+	size = (UINTN)gReadAhead * 1024;
+	if (size > DCSINT_RA_MAX) size = DCSINT_RA_MAX;
+	size &= ~((UINTN)(DCSINT_RA_ALIGN << 9) - 1);
+	if (size == 0) return EFI_SUCCESS;
+	gRaBuf = AllocateAlignedPages(EFI_SIZE_TO_PAGES(size), align);
+	if (gRaBuf == NULL) return EFI_OUT_OF_RESOURCES;
+	gRaSize = size;
+	return gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, ReadAheadExitEvent, NULL, &gRaExitEvent);
+}
+
+/**
+Drop extent if write [startSector, startSector + count) overlaps it.
+Fill in progress (nested write) is marked dirty and not kept.
+**/
+VOID
+ReadAheadInvalidate(
+	IN DCSINT_BLOCK_IO       *DcsIntBlockIo,
+	IN EFI_LBA               startSector,
+	IN UINTN                 count
+	)
+{
+	EFI_TPL  tpl;
+	if (gRaSize == 0) return;
+	tpl = gBS->RaiseTPL(TPL_NOTIFY);
+	if (gRaBusy) {
+		gRaDirty = TRUE;
+	}	else if (gRaOwner == DcsIntBlockIo && gRaCount != 0 &&
+		startSector < gRaStart + gRaCount && startSector + count > gRaStart) {
+		MEM_BURN(gRaBuf, gRaCount << 9);
+		gRaCount = 0;
+	}
+	gRaNext = 0;
+	gBS->RestoreTPL(tpl);
+}
+
+/**
+Serve read of encrypted area from extent. Returns FALSE if read has to be done
+directly (cache off or busy, not sequential, large read or fill failed).
+**/
+BOOLEAN
+ReadAheadRead(
+	IN DCSINT_BLOCK_IO       *DcsIntBlockIo,
+	IN UINT32                MediaId,
+	IN EFI_LBA               startSector,
+	IN UINTN                 BufferSize,
+	OUT VOID                 *Buffer
+	)
+{
+	EFI_STATUS   Status;
+	EFI_TPL      tpl;
+	UINTN        count = BufferSize >> 9;
+	EFI_LBA      areaStart = DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9;
+	EFI_LBA      areaEnd = (DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value + DcsIntBlockIo->CryptInfo->EncryptedAreaLength.Value) >> 9;
+	EFI_LBA      mediaEnd = DcsIntBlockIo->BlockIo->Media->LastBlock + 1;
+	EFI_LBA      fillStart;
+	UINTN        fillCount;
+	BOOLEAN      served = FALSE;
+
+	if (gRaSize == 0 || count == 0 || (BufferSize & 0x1FF) != 0 || BufferSize >= gRaSize) return FALSE;
+	tpl = gBS->RaiseTPL(TPL_NOTIFY);
+	if (gRaBusy) {
+		gBS->RestoreTPL(tpl);
+		return FALSE;
+	}
+	gRaBusy = TRUE;
+	gRaDirty = FALSE;
+	gBS->RestoreTPL(tpl);
+
+	if (gRaCount != 0 && (gRaOwner != DcsIntBlockIo || gRaMediaId != MediaId)) {
+		MEM_BURN(gRaBuf, gRaCount << 9);
+		gRaCount = 0;
+	}
+	if (gRaCount != 0 && startSector >= gRaStart && startSector + count <= gRaStart + gRaCount) {
+		served = TRUE;
+	}	else if (startSector == gRaNext && startSector + count <= areaEnd) {
+		// Sequential: read aligned extent
+		fillStart = startSector & ~((EFI_LBA)DCSINT_RA_ALIGN - 1);
+		if (fillStart < areaStart) fillStart = areaStart;
+		fillCount = gRaSize >> 9;
+		if (fillStart + fillCount > areaEnd) fillCount = (UINTN)(areaEnd - fillStart);
+		if (fillStart + fillCount > mediaEnd) fillCount = (UINTN)(mediaEnd - fillStart);
+		if (gRaCount != 0) {
+			MEM_BURN(gRaBuf, gRaCount << 9);
+			gRaCount = 0;
+		}
+		if (startSector + count <= fillStart + fillCount &&
+			!DeSectorsIntersect(fillStart << 9, ((fillStart + fillCount) << 9) - 1)) {
+			Status = DcsIntBlockIo->LowRead(DcsIntBlockIo->BlockIo, MediaId, fillStart, fillCount << 9, gRaBuf);
+			if (!EFI_ERROR(Status)) {
+				DecryptDataUnits(gRaBuf, (UINT64_STRUCT*)&fillStart, (UINT32)fillCount, DcsIntBlockIo->CryptInfo);
+				gRaOwner = DcsIntBlockIo;
+				gRaMediaId = MediaId;
+				gRaStart = fillStart;
+				gRaCount = fillCount;
+				served = TRUE;
+			}
+		}
+	}
+	if (served) {
+		CopyMem(Buffer, gRaBuf + ((startSector - gRaStart) << 9), BufferSize);
+	}
+
+	tpl = gBS->RaiseTPL(TPL_NOTIFY);
+	if (gRaDirty && gRaCount != 0) {
+		// Written while busy
+		MEM_BURN(gRaBuf, gRaCount << 9);
+		gRaCount = 0;
+		served = FALSE;
+	}
+	gRaNext = startSector + count;
+	gRaBusy = FALSE;
+	gBS->RestoreTPL(tpl);
+	return served;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Read/Write
 //////////////////////////////////////////////////////////////////////////
 EFI_STATUS
-IntBlockIO_Write(
-	IN EFI_BLOCK_IO_PROTOCOL *This,
+IntBlockIoWriteCrypt(
+	IN DCSINT_BLOCK_IO       *DcsIntBlockIo,
 	IN UINT32                MediaId,
 	IN EFI_LBA               Lba,
 	IN UINTN                 BufferSize,
-	OUT VOID                 *Buffer
+	IN VOID                  *Buffer
 	)
 {
-	DCSINT_BLOCK_IO      *DcsIntBlockIo = NULL;
-	EFI_STATUS        Status = EFI_SUCCESS;
+	EFI_STATUS           Status = EFI_SUCCESS;
 	EFI_LBA              startSector;
-	DcsIntBlockIo = GetBlockIoByProtocol(This);
-
-	if (DcsIntBlockIo) {
-		startSector = Lba;
-		startSector += gAuthBoot ? 0 : DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9;
-		//Print(L"This[0x%x] mid %x Write: lba=%lld, size=%d %r\n", This, MediaId, Lba, BufferSize, Status);
-		if ((startSector >= DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9) &&
-			(startSector < ((DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value + DcsIntBlockIo->CryptInfo->EncryptedAreaLength.Value) >> 9))) {
-			VOID*	writeCrypted;
-			writeCrypted = MEM_ALLOC(BufferSize);
-			if (writeCrypted == NULL) {
-				Status = EFI_BAD_BUFFER_SIZE;
-				return Status;
-			}
-			CopyMem(writeCrypted, Buffer, BufferSize);
-			//      Print(L"*");
-			UpdateDataBuffer(writeCrypted, (UINT32)BufferSize, startSector);
-			EncryptDataUnits(writeCrypted, (UINT64_STRUCT*)&startSector, (UINT32)(BufferSize >> 9), DcsIntBlockIo->CryptInfo);
-			Status = DcsIntBlockIo->LowWrite(This, MediaId, startSector, BufferSize, writeCrypted);
-			MEM_FREE(writeCrypted);
+	startSector = Lba;
+	startSector += gAuthBoot ? 0 : DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9;
+	ReadAheadInvalidate(DcsIntBlockIo, startSector, BufferSize >> 9);
+	//Print(L"This[0x%x] mid %x Write: lba=%lld, size=%d %r\n", This, MediaId, Lba, BufferSize, Status);
+	if ((startSector >= DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9) &&
+		(startSector < ((DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value + DcsIntBlockIo->CryptInfo->EncryptedAreaLength.Value) >> 9))) {
+		UINT8*	writeCrypted;
+		UINT8*	src = (UINT8*)Buffer;
+		UINTN		remains = BufferSize;
+		UINTN		slice;
+		writeCrypted = BounceAcquire();
+		if (writeCrypted == NULL) {
+			Status = EFI_BAD_BUFFER_SIZE;
+			return Status;
 		}
-		else {
-			Status = DcsIntBlockIo->LowWrite(This, MediaId, startSector, BufferSize, Buffer);
+		//      Print(L"*");
+		while (remains > 0 && !EFI_ERROR(Status)) {
+			slice = (remains > DCSINT_BOUNCE_SIZE) ? DCSINT_BOUNCE_SIZE : remains;
+			CopyMem(writeCrypted, src, slice);
+			UpdateDataBuffer(writeCrypted, (UINT32)slice, startSector);
+			EncryptDataUnits(writeCrypted, (UINT64_STRUCT*)&startSector, (UINT32)(slice >> 9), DcsIntBlockIo->CryptInfo);
+			Status = DcsIntBlockIo->LowWrite(DcsIntBlockIo->BlockIo, MediaId, startSector, slice, writeCrypted);
+			startSector += slice >> 9;
+			src += slice;
+			remains -= slice;
 		}
+		BounceRelease(writeCrypted);
 	}
 	else {
-		Status = EFI_BAD_BUFFER_SIZE;
+		Status = DcsIntBlockIo->LowWrite(DcsIntBlockIo->BlockIo, MediaId, startSector, BufferSize, Buffer);
 	}
 	return Status;
 }
 
 EFI_STATUS
-IntBlockIO_Read(
-	IN EFI_BLOCK_IO_PROTOCOL *This,
+IntBlockIoReadCrypt(
+	IN DCSINT_BLOCK_IO       *DcsIntBlockIo,
 	IN UINT32                MediaId,
 	IN EFI_LBA               Lba,
 	IN UINTN                 BufferSize,
 	OUT VOID                 *Buffer
 	)
 {
-	DCSINT_BLOCK_IO      *DcsIntBlockIo = NULL;
 	EFI_STATUS           Status = EFI_SUCCESS;
 	EFI_LBA              startSector;
+	startSector = Lba;
+	startSector += gAuthBoot ? 0 : DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9;
+	if ((startSector >= DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9) &&
+		ReadAheadRead(DcsIntBlockIo, MediaId, startSector, BufferSize, Buffer)) {
+		return EFI_SUCCESS;
+	}
+	Status = DcsIntBlockIo->LowRead(DcsIntBlockIo->BlockIo, MediaId, startSector, BufferSize, Buffer);
+	//Print(L"This[0x%x] mid %x ReadBlock: lba=%lld, size=%d %r\n", This, MediaId, Lba, BufferSize, Status);
+	if ((startSector >= DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9) &&
+		(startSector < ((DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value + DcsIntBlockIo->CryptInfo->EncryptedAreaLength.Value) >> 9))) {
+		//         Print(L".");
+		DecryptDataUnits(Buffer, (UINT64_STRUCT*)&startSector, (UINT32)(BufferSize >> 9), DcsIntBlockIo->CryptInfo);
+	}
+	UpdateDataBuffer(Buffer, (UINT32)BufferSize, startSector);
+	return Status;
+}
+
+//
+// Installed instance (This is DcsIntBlockIo->BlockIoHook)
+//
+EFI_STATUS
+EFIAPI
+IntBlockIO_Reset(
+	IN EFI_BLOCK_IO_PROTOCOL *This,
+	IN BOOLEAN               ExtendedVerification
+	)
+{
+	DCSINT_BLOCK_IO      *DcsIntBlockIo = DCSINT_BLOCK_IO_FROM_THIS(This);
+	return DcsIntBlockIo->BlockIo->Reset(DcsIntBlockIo->BlockIo, ExtendedVerification);
+}
+
+EFI_STATUS
+EFIAPI
+IntBlockIO_Write(
+	IN EFI_BLOCK_IO_PROTOCOL *This,
+	IN UINT32                MediaId,
+	IN EFI_LBA               Lba,
+	IN UINTN                 BufferSize,
+	IN VOID                  *Buffer
+	)
+{
+	return IntBlockIoWriteCrypt(DCSINT_BLOCK_IO_FROM_THIS(This), MediaId, Lba, BufferSize, Buffer);
+}
 
+EFI_STATUS
+EFIAPI
+IntBlockIO_Read(
+	IN EFI_BLOCK_IO_PROTOCOL *This,
+	IN UINT32                MediaId,
+	IN EFI_LBA               Lba,
+	IN UINTN                 BufferSize,
+	OUT VOID                 *Buffer
+	)
+{
+	return IntBlockIoReadCrypt(DCSINT_BLOCK_IO_FROM_THIS(This), MediaId, Lba, BufferSize, Buffer);
+}
+
+EFI_STATUS
+EFIAPI
+IntBlockIO_Flush(
+	IN EFI_BLOCK_IO_PROTOCOL *This
+	)
+{
+	DCSINT_BLOCK_IO      *DcsIntBlockIo = DCSINT_BLOCK_IO_FROM_THIS(This);
+	return DcsIntBlockIo->BlockIo->FlushBlocks(DcsIntBlockIo->BlockIo);
+}
+
+//
+// Original instance (patched for users opened it before hook)
+//
+EFI_STATUS
+EFIAPI
+IntBlockIO_WritePatched(
+	IN EFI_BLOCK_IO_PROTOCOL *This,
+	IN UINT32                MediaId,
+	IN EFI_LBA               Lba,
+	IN UINTN                 BufferSize,
+	IN VOID                  *Buffer
+	)
+{
+	DCSINT_BLOCK_IO      *DcsIntBlockIo = NULL;
 	DcsIntBlockIo = GetBlockIoByProtocol(This);
-	if (DcsIntBlockIo) {
-		startSector = Lba;
-		startSector += gAuthBoot ? 0 : DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9;
-		Status = DcsIntBlockIo->LowRead(This, MediaId, startSector, BufferSize, Buffer);
-		//Print(L"This[0x%x] mid %x ReadBlock: lba=%lld, size=%d %r\n", This, MediaId, Lba, BufferSize, Status);
-		if ((startSector >= DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value >> 9) &&
-			(startSector < ((DcsIntBlockIo->CryptInfo->EncryptedAreaStart.Value + DcsIntBlockIo->CryptInfo->EncryptedAreaLength.Value) >> 9))) {
-			//         Print(L".");
-			DecryptDataUnits(Buffer, (UINT64_STRUCT*)&startSector, (UINT32)(BufferSize >> 9), DcsIntBlockIo->CryptInfo);
-		}
-		UpdateDataBuffer(Buffer, (UINT32)BufferSize, startSector);
+	if (DcsIntBlockIo == NULL) {
+		return EFI_BAD_BUFFER_SIZE;
 	}
-	else {
-		Status = EFI_BAD_BUFFER_SIZE;
+	return IntBlockIoWriteCrypt(DcsIntBlockIo, MediaId, Lba, BufferSize, Buffer);
+}
+
+EFI_STATUS
+EFIAPI
+IntBlockIO_ReadPatched(
+	IN EFI_BLOCK_IO_PROTOCOL *This,
+	IN UINT32                MediaId,
+	IN EFI_LBA               Lba,
+	IN UINTN                 BufferSize,
+	OUT VOID                 *Buffer
+	)
+{
+	DCSINT_BLOCK_IO      *DcsIntBlockIo = NULL;
+	DcsIntBlockIo = GetBlockIoByProtocol(This);
+	if (DcsIntBlockIo == NULL) {
+		return EFI_BAD_BUFFER_SIZE;
 	}
-	return Status;
+	return IntBlockIoReadCrypt(DcsIntBlockIo, MediaId, Lba, BufferSize, Buffer);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -385,9 +829,13 @@ IntBlockIo_Hook(
 		if (DcsIntBlockIo == NULL) {
 			return EFI_OUT_OF_RESOURCES;
 		}
+		// Write buffers (on fail slices are allocated per write)
+		BouncePoolInit(BlockIo->Media->IoAlign);
+		// Read ahead extent (on fail reads are direct)
+		ReadAheadInit(BlockIo->Media->IoAlign);
 
 		// construct new DcsIntBlockIo
-		DcsIntBlockIo->Sign = DCSINT_BLOCK_IO_SIGN;
+		DcsIntBlockIo->Signature = DCSINT_BLOCK_IO_SIGN;
 		DcsIntBlockIo->Controller = DeviceHandle;
 		DcsIntBlockIo->BlockIo = BlockIo;
 		DcsIntBlockIo->IsReinstalled = 0;
@@ -397,8 +845,15 @@ IntBlockIo_Hook(
 		DcsIntBlockIo->CryptInfo = SecRegionCryptInfo;
 		DcsIntBlockIo->LowRead = BlockIo->ReadBlocks;
 		DcsIntBlockIo->LowWrite = BlockIo->WriteBlocks;
-		BlockIo->ReadBlocks = IntBlockIO_Read;
-		BlockIo->WriteBlocks = IntBlockIO_Write;
+		// New instance: DcsIntBlockIo is found from This without list search
+		CopyMem(&DcsIntBlockIo->BlockIoHook, BlockIo, sizeof(DcsIntBlockIo->BlockIoHook));
+		DcsIntBlockIo->BlockIoHook.Reset = IntBlockIO_Reset;
+		DcsIntBlockIo->BlockIoHook.ReadBlocks = IntBlockIO_Read;
+		DcsIntBlockIo->BlockIoHook.WriteBlocks = IntBlockIO_Write;
+		DcsIntBlockIo->BlockIoHook.FlushBlocks = IntBlockIO_Flush;
+		// Original instance is hooked too (it can be opened already)
+		BlockIo->ReadBlocks = IntBlockIO_ReadPatched;
+		BlockIo->WriteBlocks = IntBlockIO_WritePatched;
 
 		// close protocol before reinstall
 		gBS->CloseProtocol(
@@ -423,11 +878,11 @@ IntBlockIo_Hook(
 			DeviceHandle,
 			&gEfiBlockIoProtocolGuid,
 			BlockIo,
-			BlockIo
+			&DcsIntBlockIo->BlockIoHook
 			);
 
 //		gBS->RestoreTPL(Tpl);
-		DcsIntBlockIo->IsReinstalled = 1;
+		DcsIntBlockIo->IsReinstalled = EFI_ERROR(Status) ? 0 : 1;
 
 		Status = EFI_SUCCESS;
 	}
@@ -782,20 +1237,13 @@ EFI_STATUS
 SelectDcsBootBySignature()
 {
 	EFI_STATUS             res = EFI_NOT_FOUND;
-	EFI_BLOCK_IO_PROTOCOL* bio = NULL;
-	EFI_PARTITION_TABLE_HEADER* gptHdr;
 	UINTN                  i;
-	for (i = 0; i < gBIOCount; ++i) {
-		if(EfiIsPartition(gBIOHandles[i])) continue;
-		bio = EfiGetBlockIO(gBIOHandles[i]);
-		if(bio == NULL) continue;
-		res = bio->ReadBlocks(bio, bio->Media->MediaId, 0, 512, Header);
-		if(EFI_ERROR(res)) continue;
-		if((*(UINT32*)(Header+0x1b8)) != BootDriveSignature) continue;
-		res = bio->ReadBlocks(bio, bio->Media->MediaId, 1, 512, Header);
-		if (EFI_ERROR(res)) continue;
-		gptHdr = (EFI_PARTITION_TABLE_HEADER*)Header;
-		if (CompareMem(&BootDriveSignatureGpt, &gptHdr->DiskGUID, sizeof(BootDriveSignatureGpt)) != 0) continue;
+	res = DiskProbeAll();
+	if (EFI_ERROR(res)) return res;
+	for (i = 0; i < gDiskProbesCount; ++i) {
+		if (EFI_ERROR(gDiskProbes[i].Status)) continue;
+		if (gDiskProbes[i].MbrId != BootDriveSignature) continue;
+		if (CompareMem(&BootDriveSignatureGpt, &gDiskProbes[i].GptId, sizeof(BootDriveSignatureGpt)) != 0) continue;
 		gDcsBoot = DevicePathFromHandle(gBIOHandles[i]);
 		gDcsBootSize = GetDevicePathSize(gDcsBoot);
 		return EFI_SUCCESS;
@@ -810,8 +1258,28 @@ SecRegionTryDecrypt()
 	EFI_STATUS   res = EFI_SUCCESS;
 	int          retry = gAuthRetry;
 	BOOLEAN      firstPrompt = TRUE;
+	char**       zones = NULL;
+	UINTN        zonesCount = 0;
+	UINTN        zone = 0;
 	PlatformGetID(SecRegionHandle, &gPlatformKeyFile, &gPlatformKeyFileSize);
 
+	// Authorization zones. EFI tables are skipped once.
+	zones = (char**)MEM_ALLOC(sizeof(char*) * (SecRegionSize / (1024 * 128) + 1));
+	if (zones == NULL) {
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	SecRegionOffset = 0;
+	while (SecRegionOffset < SecRegionSize) {
+		if (TablesVerify(SecRegionSize - SecRegionOffset, SecRegionData + SecRegionOffset)) {
+			EFI_TABLE_HEADER *mhdr = (EFI_TABLE_HEADER *)(SecRegionData + SecRegionOffset);
+			UINTN tblZones = (mhdr->HeaderSize + 1024 * 128 - 1) / (1024 * 128);
+			SecRegionOffset += tblZones * 1024 * 128;
+			continue;
+		}
+		zones[zonesCount++] = (char*)(SecRegionData + SecRegionOffset);
+		SecRegionOffset += 1024 * 128;
+	}
+
 	do {
 		SecRegionOffset = 0;
 		if (firstPrompt) {
@@ -821,27 +1289,19 @@ SecRegionTryDecrypt()
 		}
 		VCAuthAsk();
 		if (gAuthPwdCode == AskPwdRetCancel) {
+			MEM_FREE(zones);
 			return EFI_DCS_USER_CANCELED;
 		}
 		if (gAuthPwdCode == AskPwdRetTimeout) {
+			MEM_FREE(zones);
 			return EFI_TIMEOUT;
 		}
 		OUT_PRINT(L"%a", gAuthStartMsg);
-		do {
-			// EFI tables?
-			if (TablesVerify(SecRegionSize - SecRegionOffset, SecRegionData + SecRegionOffset)) {
-				EFI_TABLE_HEADER *mhdr = (EFI_TABLE_HEADER *)(SecRegionData + SecRegionOffset);
-				UINTN tblZones = (mhdr->HeaderSize + 1024 * 128 - 1) / (1024 * 128);
-				SecRegionOffset += tblZones * 1024 * 128;
-				vcres = 1;
-				continue;
-			}
-			// Try authorize zone
-			CopyMem(Header, SecRegionData + SecRegionOffset, 512);
-			vcres = ReadVolumeHeader(gAuthBoot, Header, &gAuthPassword, gAuthHash, gAuthPim, &SecRegionCryptInfo, NULL);
-		   SecRegionOffset += (vcres != 0) ? 1024 * 128 : 0;
-		} while (SecRegionOffset < SecRegionSize && vcres != 0);
+		// Try authorize all zones at once
+		vcres = ReadVolumeHeadersMp(gAuthBoot, zones, zonesCount, &gAuthPassword, gAuthHash, gAuthPim, &zone, &SecRegionCryptInfo, NULL);
 		if (vcres == 0) {
+			SecRegionOffset = (UINTN)((UINT8*)zones[zone] - SecRegionData);
+			CopyMem(Header, SecRegionData + SecRegionOffset, 512);
 			OUT_PRINT(L"Success\n");
 			OUT_PRINT(L"Start %d %lld len %lld\n", SecRegionOffset / (1024*128), SecRegionCryptInfo->EncryptedAreaStart.Value, SecRegionCryptInfo->EncryptedAreaLength.Value);
 			break;
@@ -854,12 +1314,14 @@ SecRegionTryDecrypt()
 		}
 		retry--;
 	} while (vcres != 0 && retry > 0);
+	MEM_FREE(zones);
 	if (vcres != 0) {
 		return EFI_CRC_ERROR;
 	}
 
 	SecRegionSector = 62 + SecRegionOffset / 512;
 	DeList = NULL;
+	gDeSectorsCount = 0;
 	if (SecRegionSize > 512) {
 		UINT64 startUnit = 0;
 		DecryptDataUnits(SecRegionData + SecRegionOffset + 512, (UINT64_STRUCT*)&startUnit,(UINT32)255, SecRegionCryptInfo);
@@ -868,6 +1330,7 @@ SecRegionTryDecrypt()
 			return EFI_CRC_ERROR;
 		}
 		DeList = (DCS_DISK_ENTRY_LIST *)(SecRegionData + SecRegionOffset + 512);
+		DeSectorsIndexBuild();
 		CopyMem(&BootDriveSignature, &DeList->DE[DE_IDX_DISKID].DiskId.MbrID, sizeof(BootDriveSignature));
 		CopyMem(&BootDriveSignatureGpt, &DeList->DE[DE_IDX_DISKID].DiskId.GptID, sizeof(BootDriveSignatureGpt));
 
@@ -1033,6 +1496,9 @@ OnExit(
 	EFI_GUID *guid = NULL;
 	CHAR16  *fileStr  = NULL;
 
+	TraceMark("DcsInt exit");
+	TraceSave();
+	DcsTpm2Release();
 	if (EFI_ERROR(retValue))
 	{
 		CleanSensitiveData(TRUE);
@@ -1235,8 +1701,10 @@ UefiMain(
 {
 	EFI_STATUS res;
 
+	TraceMark("DcsInt");
 	InitBio();
 	InitFS();
+	TraceMark("DcsInt InitBio/InitFS");
 	gRescueBoot = IsRescueBoot();
 	if (gRescueBoot) {
 		res = GetRescueExecPartGuid(&gRescueExecPartGuid);
@@ -1250,6 +1718,7 @@ UefiMain(
 
 	// Load auth parameters
 	VCAuthLoadConfig();
+	TraceMark("Config load");
 	if (gRescueBoot) {
 		res = SecRegionLoadBackup();
 		if (EFI_ERROR(res)) {
@@ -1257,6 +1726,7 @@ UefiMain(
 		}
 	} else if (gAuthSecRegionSearch) {
 		res = PlatformGetAuthData(&SecRegionData, &SecRegionSize, &SecRegionHandle);
+		TraceMark("PlatformGetAuthData");
 		if (!EFI_ERROR(res)) {
 			gSecRegionFromBackup = FALSE;
 			VCAuthLoadConfigUpdated(SecRegionData, SecRegionSize);
@@ -1338,6 +1808,12 @@ UefiMain(
 
 	res = GetTpm(); // Try to get TPM
 	if (!EFI_ERROR(res)) {
+		// Measured configuration is DcsProp even if precompiled one is used
+		if (ConfigLoadSource()) {
+			MEM_FREE(gAuthPasswordMsg);
+			gAuthPasswordMsg = NULL;
+			VCAuthLoadConfig();
+		}
 		if (gConfigBuffer != NULL) {
 			gTpm->Measure(gTpm, DCS_TPM_PCR_LOCK, gConfigBufferSize, gConfigBuffer); // Measure configuration
 		}
@@ -1346,9 +1822,12 @@ UefiMain(
 			Pause(gTPMLockedInfoDelay);
 		}
 	}
+	TraceMark("GetTpm");
 
 	DetectX86Features();
+	InitMp();
 	res = SecRegionTryDecrypt();
+	TraceMark("SecRegionTryDecrypt");
 	if (gTpm != NULL) {
 		gTpm->Lock(gTpm);
 	}
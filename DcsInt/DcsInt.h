@@ -34,10 +34,11 @@ typedef struct _DCSINT_BLOCK_IO  DCSINT_BLOCK_IO, *PDCSINT_BLOCK_IO;
 typedef struct CRYPTO_INFO_t CRYPTO_INFO, *PCRYPTO_INFO;
 
 typedef struct _DCSINT_BLOCK_IO {
-   UINT32                     Sign;
+   UINT32                     Signature;
    EFI_HANDLE                 Controller;
 
-   EFI_BLOCK_IO_PROTOCOL      *BlockIo;
+   EFI_BLOCK_IO_PROTOCOL      BlockIoHook;   //< Instance installed on Controller
+   EFI_BLOCK_IO_PROTOCOL      *BlockIo;      //< Original instance
    EFI_BLOCK_READ             LowRead;
    EFI_BLOCK_WRITE            LowWrite;
    UINT32                     IsReinstalled;
@@ -45,6 +46,8 @@ typedef struct _DCSINT_BLOCK_IO {
    DCSINT_BLOCK_IO*           Next;
 } DCSINT_BLOCK_IO, *PDCSINT_BLOCK_IO;
 
+#define DCSINT_BLOCK_IO_FROM_THIS(a) CR(a, DCSINT_BLOCK_IO, BlockIoHook, DCSINT_BLOCK_IO_SIGN)
+
 //
 // Functions for Driver Binding Protocol
 //
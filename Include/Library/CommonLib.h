@@ -21,6 +21,7 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Protocol/SimpleFileSystem.h>
 #include <Protocol/UsbIo.h>
 #include <Protocol/AbsolutePointer.h>
+#include <Protocol/MpService.h>
 #include <Guid/FileInfo.h>
 #include <Uefi/UefiGpt.h>
 
@@ -159,6 +160,27 @@ EfiFindPartByGUID(
 	OUT  EFI_HANDLE*             h
 	);
 
+//////////////////////////////////////////////////////////////////////////
+// Disk probe
+//////////////////////////////////////////////////////////////////////////
+typedef struct _DISK_PROBE {
+	EFI_HANDLE  Handle;
+	EFI_STATUS  Status;          // EFI_UNSUPPORTED for partitions
+	EFI_STATUS  HeaderStatus;
+	UINT32      MbrId;           // MBR disk signature (0x1b8)
+	EFI_GUID    GptId;           // DiskGUID of sector 1
+	UINT8       Header[512];     // sector 62
+} DISK_PROBE;
+
+extern DISK_PROBE* gDiskProbes;   // same indexes as gBIOHandles
+extern UINTN       gDiskProbesCount;
+
+EFI_STATUS
+DiskProbeAll();
+
+VOID
+DiskProbeFree();
+
 //////////////////////////////////////////////////////////////////////////
 // GPT
 //////////////////////////////////////////////////////////////////////////
@@ -188,6 +210,13 @@ GptReadEntryArray(
 	OUT EFI_PARTITION_ENTRY         **Entrys
 	);
 
+EFI_STATUS
+GptCheckHeader(
+	IN  EFI_PARTITION_TABLE_HEADER  *PartHdr,
+	IN  EFI_LBA                     HeaderLba,
+	IN  UINT32                      BlockSize
+	);
+
 EFI_STATUS
 GptReadHeader(
 	IN  EFI_BLOCK_IO_PROTOCOL*      BlockIo,
@@ -252,6 +281,109 @@ extern UINTN       gTcg2Count;
 EFI_STATUS
 InitTcg();
 
+//////////////////////////////////////////////////////////////////////////
+// Timer
+//////////////////////////////////////////////////////////////////////////
+extern UINT64 gTimerTicksPerMs;
+
+/**
+Calibrate time stamp counter. Called on first TimerTicksToUs if not done.
+**/
+EFI_STATUS
+InitTimer();
+
+UINT64
+TimerTicks();
+
+UINT64
+TimerTicksToUs(
+	IN UINT64 ticks
+	);
+
+UINT64
+TimerElapsedUs(
+	IN UINT64 startTicks
+	);
+
+//////////////////////////////////////////////////////////////////////////
+// Boot trace
+//////////////////////////////////////////////////////////////////////////
+#define DCS_TRACE_MAX        64
+#define DCS_TRACE_NAME_MAX   24
+#define DCS_TRACE_VAR        L"DcsTrace"
+#define DCS_TRACE_FILE       L"\\EFI\\VeraCrypt\\DcsTrace"
+
+// gTraceSave flags (config TraceBoot)
+#define DCS_TRACE_SAVE_VAR   1
+#define DCS_TRACE_SAVE_FILE  2
+
+#pragma pack(1)
+typedef struct _DCS_TRACE_ENTRY {
+	UINT64  Ticks;
+	CHAR8   Name[DCS_TRACE_NAME_MAX];
+} DCS_TRACE_ENTRY;
+
+typedef struct _DCS_TRACE {
+	UINT32           Count;
+	UINT32           Reserved;
+	UINT64           TicksPerMs;
+	DCS_TRACE_ENTRY  Entries[DCS_TRACE_MAX];
+} DCS_TRACE;
+#pragma pack()
+
+extern UINTN gTraceSave;
+
+/**
+Record end of boot phase (time stamp counter).
+**/
+VOID
+TraceMark(
+	IN CONST CHAR8* name
+	);
+
+/**
+Save marks to volatile variable DcsTrace (and to file if DCS_TRACE_SAVE_FILE)
+if gTraceSave is set.
+**/
+EFI_STATUS
+TraceSave();
+
+EFI_STATUS
+TraceLoad(
+	OUT DCS_TRACE  **trace
+	);
+
+VOID
+TracePrint(
+	IN DCS_TRACE  *trace
+	);
+
+//////////////////////////////////////////////////////////////////////////
+// Multiprocessor
+//////////////////////////////////////////////////////////////////////////
+extern EFI_MP_SERVICES_PROTOCOL* gMpServices;
+extern UINTN                     gMpCpuCount;
+
+typedef VOID(*MP_SLICE_PROC)(
+	IN VOID*  ctx,
+	IN UINTN  slice
+	);
+
+EFI_STATUS
+InitMp();
+
+/**
+Run proc for every slice in [0, slices) on all enabled processors (BSP included).
+Falls back to BSP only if MP services are not available.
+proc is called on APs: it must not use boot services.
+**/
+EFI_STATUS
+MpRunSlices(
+	IN MP_SLICE_PROC  proc,
+	IN VOID*          ctx,
+	IN UINTN          slices
+	);
+
 //////////////////////////////////////////////////////////////////////////
 // USB
 //////////////////////////////////////////////////////////////////////////
@@ -369,6 +501,21 @@ KeyWait(
 EFI_INPUT_KEY
 GetKey(void);
 
+// Background work done while waiting for key. Returns TRUE if work is left.
+typedef
+BOOLEAN
+(*KEY_IDLE_PROC)();
+
+extern KEY_IDLE_PROC gKeyIdleProc;
+
+VOID
+KeyIdle(
+	IN EFI_EVENT  waitEvent
+	);
+
+VOID
+KeyIdleStep();
+
 VOID
 ConsoleShowTip(
 	IN CHAR16* tip,
@@ -248,5 +248,13 @@ RndGetBytes(UINT8 *buf, UINTN len);
 EFI_STATUS
 RndPreapare();
 
+// Burn cached key schedule of HMAC DRBG and TPM random pool
+VOID
+RndCacheBurn();
+
+// TPM random pool size and refill level (0 - no pool)
+extern UINTN gRndTpmPoolSize;
+extern UINTN gRndTpmPoolLow;
+
 #endif
 
@@ -101,6 +101,12 @@ DcsTpm2DumpPcrs(
 EFI_STATUS
 Tpm20Tests();
 
+/**
+Flush policy session kept for NV reads (no TPM slot is left to OS).
+**/
+VOID
+DcsTpm2Release();
+
 VOID
 DcsInitTpm20(
 	IN OUT DCS_TPM_PROTOCOL* Tpm);
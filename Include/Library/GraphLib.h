@@ -48,11 +48,18 @@ typedef struct _RECT {
 	UINT32 bottom;
 } RECT, *PRECT;
 
+#define BLT_DIRTY_MAX   8
+// Extra pixels allowed when two dirty rectangles are merged
+#define BLT_DIRTY_SLACK (32 * 32)
+
 #pragma pack(1)
 typedef struct {
 	UINT32   Width;
 	UINT32   Height;
-	RECT     Dirty;
+	RECT     Dirty;                     // Bounding box of DirtyRects
+	UINT32   DirtyCount;
+	UINT32   DirtyLast;                 // Last extended rectangle
+	RECT     DirtyRects[BLT_DIRTY_MAX];
 	EFI_GRAPHICS_OUTPUT_BLT_PIXEL	 Pixels[0];
 } BLT_HEADER;
 #pragma pack()
@@ -127,6 +134,16 @@ RectMarkDirty(
 	IN UINTN y
 	);
 
+// Add [x0,x1] x [y0,y1] (inclusive) to dirty rectangles of blt
+VOID
+BltMarkDirty(
+	IN OUT BLT_HEADER* blt,
+	IN UINTN x0,
+	IN UINTN y0,
+	IN UINTN x1,
+	IN UINTN y1
+	);
+
 EFI_STATUS
 BltPoint(
 	IN BLT_HEADER* blt,
@@ -171,6 +188,10 @@ BltText(
 	IN INT32 scale, // 0..256 reduce 256... enlarge
 	IN CONST CHAR8 *text);
 
+// Free rasterized glyphs used by BltText
+VOID
+BltTextCacheFree();
+
 
 EFI_STATUS
 BmpGetSize(
@@ -197,4 +218,15 @@ BltFill(
 	IN INT32 y1
 	);
 
+// Rectangle [x0,x1) x [y0,y1) with draw operation (brush is not used)
+VOID
+BltFillRect(
+	IN BLT_HEADER* blt,
+	IN PDRAW_CONTEXT draw,
+	IN INT32 x0,
+	IN INT32 y0,
+	IN INT32 x1,
+	IN INT32 y1
+	);
+
 #endif
\ No newline at end of file
@@ -17,6 +17,7 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Library/MemoryAllocationLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Protocol/LoadedImage.h>
+#include <Protocol/BlockIo2.h>
 
 //////////////////////////////////////////////////////////////////////////
 // Print handle info
@@ -230,4 +231,113 @@ EfiFindPartByGUID(
 	return EFI_NOT_FOUND;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Disk probe
+//////////////////////////////////////////////////////////////////////////
+// Sectors 0..62 of all whole disks are read at once (EFI_BLOCK_IO2_PROTOCOL
+// requests are started for all disks before waiting) and MBR signature,
+// GPT DiskGUID and header sector are kept until handles change.
+#define DISK_PROBE_SECTORS 63
+
+DISK_PROBE* gDiskProbes = NULL;
+UINTN       gDiskProbesCount = 0;
+
+VOID
+DiskProbeFree()
+{
+	if (gDiskProbes != NULL) {
+		MEM_BURN(gDiskProbes, sizeof(DISK_PROBE) * gDiskProbesCount);
+		MEM_FREE(gDiskProbes);
+	}
+	gDiskProbes = NULL;
+	gDiskProbesCount = 0;
+}
+
+EFI_STATUS
+DiskProbeAll()
+{
+	UINTN                   i;
+	UINTN                   idx;
+	UINTN                   sectors;
+	UINT8                   **bufs = NULL;
+	EFI_BLOCK_IO2_TOKEN     *tokens = NULL;
+	DISK_PROBE              *probe;
+	EFI_BLOCK_IO_PROTOCOL   *bio;
+	EFI_BLOCK_IO2_PROTOCOL  *bio2;
+	BOOLEAN                 cached;
+
+	cached = gDiskProbes != NULL && gDiskProbesCount == gBIOCount;
+	for (i = 0; cached && i < gBIOCount; ++i) {
+		if (gDiskProbes[i].Handle != gBIOHandles[i]) cached = FALSE;
+	}
+	if (cached) return EFI_SUCCESS;
+
+	DiskProbeFree();
+	gDiskProbes = MEM_ALLOC(sizeof(DISK_PROBE) * gBIOCount);
+	bufs = MEM_ALLOC(sizeof(UINT8*) * gBIOCount);
+	tokens = MEM_ALLOC(sizeof(EFI_BLOCK_IO2_TOKEN) * gBIOCount);
+	if (gDiskProbes == NULL || bufs == NULL || tokens == NULL) {
+		MEM_FREE(gDiskProbes);
+		MEM_FREE(bufs);
+		MEM_FREE(tokens);
+		gDiskProbes = NULL;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	gDiskProbesCount = gBIOCount;
+
+	// Start reads
+	for (i = 0; i < gBIOCount; ++i) {
+		probe = &gDiskProbes[i];
+		probe->Handle = gBIOHandles[i];
+		probe->Status = EFI_UNSUPPORTED;
+		probe->HeaderStatus = EFI_UNSUPPORTED;
+		if (EfiIsPartition(probe->Handle)) continue;
+		bio = EfiGetBlockIO(probe->Handle);
+		if (bio == NULL || bio->Media->BlockSize != 512) continue;
+		sectors = (bio->Media->LastBlock + 1 < DISK_PROBE_SECTORS) ? (UINTN)bio->Media->LastBlock + 1 : DISK_PROBE_SECTORS;
+		if (sectors < 2) continue;
+		bufs[i] = MEM_ALLOC(sectors * 512);
+		if (bufs[i] == NULL) {
+			probe->Status = EFI_BUFFER_TOO_SMALL;
+			continue;
+		}
+		probe->HeaderStatus = (sectors == DISK_PROBE_SECTORS) ? EFI_SUCCESS : EFI_END_OF_MEDIA;
+		bio2 = NULL;
+		if (!EFI_ERROR(gBS->HandleProtocol(probe->Handle, &gEfiBlockIo2ProtocolGuid, (VOID**)&bio2)) &&
+			!EFI_ERROR(gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &tokens[i].Event))) {
+			tokens[i].TransactionStatus = EFI_NOT_READY;
+			probe->Status = bio2->ReadBlocksEx(bio2, bio2->Media->MediaId, 0, &tokens[i], sectors * 512, bufs[i]);
+			if (EFI_ERROR(probe->Status)) {
+				gBS->CloseEvent(tokens[i].Event);
+				tokens[i].Event = NULL;
+			}
+		}
+		if (tokens[i].Event == NULL) {
+			probe->Status = bio->ReadBlocks(bio, bio->Media->MediaId, 0, sectors * 512, bufs[i]);
+		}
+	}
 
+	// Wait and parse
+	for (i = 0; i < gBIOCount; ++i) {
+		probe = &gDiskProbes[i];
+		if (tokens[i].Event != NULL) {
+			gBS->WaitForEvent(1, &tokens[i].Event, &idx);
+			probe->Status = tokens[i].TransactionStatus;
+			gBS->CloseEvent(tokens[i].Event);
+		}
+		if (bufs[i] == NULL) continue;
+		if (!EFI_ERROR(probe->Status)) {
+			CopyMem(&probe->MbrId, bufs[i] + 0x1b8, sizeof(probe->MbrId));
+			CopyMem(&probe->GptId, &((EFI_PARTITION_TABLE_HEADER*)(bufs[i] + 512))->DiskGUID, sizeof(probe->GptId));
+			if (!EFI_ERROR(probe->HeaderStatus)) {
+				CopyMem(probe->Header, bufs[i] + 62 * 512, 512);
+			}
+		}	else {
+			probe->HeaderStatus = probe->Status;
+		}
+		MEM_FREE(bufs[i]);
+	}
+	MEM_FREE(bufs);
+	MEM_FREE(tokens);
+	return EFI_SUCCESS;
+}
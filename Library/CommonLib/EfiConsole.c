@@ -139,6 +139,33 @@ KeyWait(
    return key;
 }
 
+KEY_IDLE_PROC gKeyIdleProc = NULL;
+
+/**
+Run idle procedure step by step until event is signaled or no work left.
+**/
+VOID
+KeyIdle(
+	IN EFI_EVENT  waitEvent
+	)
+{
+	while (gKeyIdleProc != NULL && gBS->CheckEvent(waitEvent) == EFI_NOT_READY) {
+		if (!gKeyIdleProc()) break;
+	}
+}
+
+/**
+Run one step of idle procedure. For loops waiting on several events, so
+timers and other inputs are handled between steps.
+**/
+VOID
+KeyIdleStep()
+{
+	if (gKeyIdleProc != NULL) {
+		gKeyIdleProc();
+	}
+}
+
 EFI_INPUT_KEY 
 GetKey(void) 
 {
@@ -147,6 +174,7 @@ GetKey(void)
 	EFI_STATUS res1;
 	EFI_STATUS res2;
 	do {
+		KeyIdle(gST->ConIn->WaitForKey);
 		res1 = gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
 		res2 = gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
 	} while (EFI_ERROR(res1) || EFI_ERROR(res2));
@@ -0,0 +1,103 @@
+/** @file
+EFI multiprocessor helpers
+
+Copyright (c) 2016. Disk Cryptography Services for EFI (DCS), Alex Kolotnikov
+Copyright (c) 2016. VeraCrypt, Mounir IDRASSI
+
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the GNU Lesser General Public License, version 3.0 (LGPL-3.0).
+
+The full text of the license may be found at
+https://opensource.org/licenses/LGPL-3.0
+**/
+
+#include <Library/CommonLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Protocol/MpService.h>
+
+EFI_MP_SERVICES_PROTOCOL* gMpServices = NULL;
+UINTN                     gMpCpuCount = 1;
+
+typedef struct _MP_JOB {
+	MP_SLICE_PROC     Proc;
+	VOID*             Ctx;
+	UINT32            Slices;
+	volatile UINT32   Next;
+} MP_JOB;
+
+EFI_STATUS
+InitMp() {
+	EFI_STATUS res;
+	UINTN      total = 0;
+	UINTN      enabled = 0;
+	gMpCpuCount = 1;
+	res = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (VOID**)&gMpServices);
+	if (EFI_ERROR(res)) {
+		gMpServices = NULL;
+		return res;
+	}
+	res = gMpServices->GetNumberOfProcessors(gMpServices, &total, &enabled);
+	if (EFI_ERROR(res) || enabled == 0) {
+		gMpServices = NULL;
+		return EFI_ERROR(res) ? res : EFI_NOT_FOUND;
+	}
+	gMpCpuCount = enabled;
+	return EFI_SUCCESS;
+}
+
+/**
+Worker loop run by BSP and every AP. Slices are taken one by one from the
+shared counter, so fast processors take more slices than slow ones.
+**/
+VOID
+EFIAPI
+MpJobWorker(
+	IN VOID* arg
+	)
+{
+	MP_JOB* job = (MP_JOB*)arg;
+	UINT32  slice;
+	while ((slice = InterlockedIncrement(&job->Next) - 1) < job->Slices) {
+		job->Proc(job->Ctx, slice);
+	}
+}
+
+EFI_STATUS
+MpRunSlices(
+	IN MP_SLICE_PROC  proc,
+	IN VOID*          ctx,
+	IN UINTN          slices
+	)
+{
+	EFI_STATUS res = EFI_NOT_STARTED;
+	EFI_EVENT  done = NULL;
+	UINTN      idx;
+	MP_JOB     job;
+
+	if (proc == NULL || slices > MAX_UINT32) return EFI_INVALID_PARAMETER;
+	job.Proc = proc;
+	job.Ctx = ctx;
+	job.Slices = (UINT32)slices;
+	job.Next = 0;
+
+	if (gMpServices != NULL && gMpCpuCount > 1 && slices > 1) {
+		// Non blocking start: BSP takes slices too while APs are busy
+		res = gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &done);
+		if (!EFI_ERROR(res)) {
+			res = gMpServices->StartupAllAPs(gMpServices, MpJobWorker, FALSE, done, 0, &job, NULL);
+			if (!EFI_ERROR(res)) {
+				MpJobWorker(&job);
+				gBS->WaitForEvent(1, &done, &idx);
+			}
+			gBS->CloseEvent(done);
+		}
+		if (EFI_ERROR(res) && res != EFI_NOT_STARTED) {
+			// Firmware without non blocking mode
+			res = gMpServices->StartupAllAPs(gMpServices, MpJobWorker, FALSE, NULL, 0, &job, NULL);
+		}
+	}
+	// Single CPU or leftovers
+	MpJobWorker(&job);
+	return EFI_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/** @file
+EFI timer helpers (TSC based)
+
+Copyright (c) 2016. Disk Cryptography Services for EFI (DCS), Alex Kolotnikov
+Copyright (c) 2016. VeraCrypt, Mounir IDRASSI
+
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the GNU Lesser General Public License, version 3.0 (LGPL-3.0).
+
+The full text of the license may be found at
+https://opensource.org/licenses/LGPL-3.0
+**/
+
+#include <Library/CommonLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseLib.h>
+
+UINT64 gTimerTicksPerMs = 0;
+
+EFI_STATUS
+InitTimer() {
+	UINT64 start;
+	UINT64 end;
+	start = AsmReadTsc();
+	gBS->Stall(10000);
+	end = AsmReadTsc();
+	gTimerTicksPerMs = (end - start) / 10;
+	if (gTimerTicksPerMs == 0) {
+		gTimerTicksPerMs = 1;
+		return EFI_UNSUPPORTED;
+	}
+	return EFI_SUCCESS;
+}
+
+UINT64
+TimerTicks() {
+	return AsmReadTsc();
+}
+
+UINT64
+TimerTicksToUs(
+	IN UINT64 ticks
+	)
+{
+	if (gTimerTicksPerMs == 0) InitTimer();
+	return (ticks / gTimerTicksPerMs) * 1000 + (ticks % gTimerTicksPerMs) * 1000 / gTimerTicksPerMs;
+}
+
+UINT64
+TimerElapsedUs(
+	IN UINT64 startTicks
+	)
+{
+	return TimerTicksToUs(AsmReadTsc() - startTicks);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Boot trace
+//////////////////////////////////////////////////////////////////////////
+// Marks are kept in memory ring. TraceSave merges them (by time) with marks
+// saved before by other images (DcsBoot, DcsInt) of this boot.
+UINTN      gTraceSave = 0;
+DCS_TRACE  gTrace;
+
+VOID
+TraceMark(
+	IN CONST CHAR8* name
+	)
+{
+	DCS_TRACE_ENTRY *e;
+	UINTN           i;
+	e = &gTrace.Entries[gTrace.Count % DCS_TRACE_MAX];
+	e->Ticks = AsmReadTsc();
+	for (i = 0; i < DCS_TRACE_NAME_MAX - 1 && name[i] != 0; ++i) {
+		e->Name[i] = name[i];
+	}
+	e->Name[i] = 0;
+	gTrace.Count++;
+}
+
+EFI_STATUS
+TraceSave()
+{
+	EFI_STATUS       res;
+	DCS_TRACE        *saved = NULL;
+	DCS_TRACE        *merged;
+	DCS_TRACE_ENTRY  tmp;
+	UINTN            size = 0;
+	UINT32           attr;
+	UINTN            i;
+	UINTN            j;
+	UINTN            n = 0;
+	UINTN            first;
+	UINTN            own;
+
+	if (gTraceSave == 0) return EFI_SUCCESS;
+	if (gTimerTicksPerMs == 0) InitTimer();
+	merged = MEM_ALLOC(sizeof(DCS_TRACE) + sizeof(DCS_TRACE_ENTRY) * DCS_TRACE_MAX);
+	if (merged == NULL) return EFI_BUFFER_TOO_SMALL;
+
+	res = EfiGetVar(DCS_TRACE_VAR, NULL, (VOID**)&saved, &size, &attr);
+	if (!EFI_ERROR(res) && size == sizeof(DCS_TRACE) && saved->Count <= DCS_TRACE_MAX) {
+		for (i = 0; i < saved->Count; ++i) {
+			merged->Entries[n++] = saved->Entries[i];
+		}
+	}
+	MEM_FREE(saved);
+
+	own = (gTrace.Count < DCS_TRACE_MAX) ? gTrace.Count : DCS_TRACE_MAX;
+	first = (gTrace.Count < DCS_TRACE_MAX) ? 0 : gTrace.Count % DCS_TRACE_MAX;
+	for (i = 0; i < own; ++i) {
+		merged->Entries[n++] = gTrace.Entries[(first + i) % DCS_TRACE_MAX];
+	}
+	// Marks are merged, next save must not add them again
+	gTrace.Count = 0;
+
+	// Insertion sort by time, latest DCS_TRACE_MAX are kept
+	for (i = 1; i < n; ++i) {
+		tmp = merged->Entries[i];
+		for (j = i; j > 0 && merged->Entries[j - 1].Ticks > tmp.Ticks; --j) {
+			merged->Entries[j] = merged->Entries[j - 1];
+		}
+		merged->Entries[j] = tmp;
+	}
+	if (n > DCS_TRACE_MAX) {
+		CopyMem(&merged->Entries[0], &merged->Entries[n - DCS_TRACE_MAX], sizeof(DCS_TRACE_ENTRY) * DCS_TRACE_MAX);
+		n = DCS_TRACE_MAX;
+	}
+	merged->Count = (UINT32)n;
+	merged->Reserved = 0;
+	merged->TicksPerMs = gTimerTicksPerMs;
+
+	res = EfiSetVar(DCS_TRACE_VAR, NULL, merged, sizeof(DCS_TRACE), EFI_VARIABLE_BOOTSERVICE_ACCESS);
+	if ((gTraceSave & DCS_TRACE_SAVE_FILE) != 0) {
+		FileSave(NULL, DCS_TRACE_FILE, merged, sizeof(DCS_TRACE));
+	}
+	MEM_FREE(merged);
+	return res;
+}
+
+EFI_STATUS
+TraceLoad(
+	OUT DCS_TRACE  **trace
+	)
+{
+	EFI_STATUS  res;
+	UINTN       size = 0;
+	UINT32      attr;
+	*trace = NULL;
+	res = EfiGetVar(DCS_TRACE_VAR, NULL, (VOID**)trace, &size, &attr);
+	if (EFI_ERROR(res) || size != sizeof(DCS_TRACE)) {
+		MEM_FREE(*trace);
+		*trace = NULL;
+		res = FileLoad(NULL, DCS_TRACE_FILE, (VOID**)trace, &size);
+		if (EFI_ERROR(res)) return res;
+	}
+	if (size != sizeof(DCS_TRACE) || (*trace)->Count > DCS_TRACE_MAX) {
+		MEM_FREE(*trace);
+		*trace = NULL;
+		return EFI_CRC_ERROR;
+	}
+	return EFI_SUCCESS;
+}
+
+VOID
+TracePrint(
+	IN DCS_TRACE  *trace
+	)
+{
+	UINTN   i;
+	UINT64  tpm;
+	UINT64  start;
+	UINT64  prev;
+	tpm = (trace->TicksPerMs != 0) ? trace->TicksPerMs : 1;
+	if (trace->Count == 0) return;
+	start = trace->Entries[0].Ticks;
+	prev = start;
+	OUT_PRINT(L"%H%10s %10s  %s%N\n", L"ms", L"delta ms", L"phase");
+	for (i = 0; i < trace->Count; ++i) {
+		OUT_PRINT(L"%10lld %10lld  %a\n",
+			(trace->Entries[i].Ticks - start) / tpm,
+			(trace->Entries[i].Ticks - prev) / tpm,
+			trace->Entries[i].Name);
+		prev = trace->Entries[i].Ticks;
+	}
+}
@@ -176,6 +176,32 @@ GptReadEntryArray(
 	return GptCheckEntryArray(PartHeader, *Entrys);
 }
 
+/**
+Check GPT header already in memory (signature, CRC, location)
+
+@param[in]  PartHdr     Partition table header
+@param[in]  HeaderLba   LBA the header was read from
+@param[in]  BlockSize   Block size of the disk
+
+@retval EFI_SUCCESS     header is valid
+**/
+EFI_STATUS
+GptCheckHeader(
+	IN  EFI_PARTITION_TABLE_HEADER  *PartHdr,
+	IN  EFI_LBA                     HeaderLba,
+	IN  UINT32                      BlockSize
+	)
+{
+	if ((PartHdr->Header.Signature != EFI_PTAB_HEADER_ID) ||
+		!GptHeaderCheckCrc(BlockSize, &PartHdr->Header) ||
+		PartHdr->MyLBA != HeaderLba ||
+		(PartHdr->SizeOfPartitionEntry < sizeof(EFI_PARTITION_ENTRY))
+		) {
+		return EFI_CRC_ERROR;
+	}
+	return EFI_SUCCESS;
+}
+
 EFI_STATUS
 GptReadHeader(
 	IN  EFI_BLOCK_IO_PROTOCOL*      BlockIo,
@@ -199,13 +225,10 @@ GptReadHeader(
 	}
 
 	// Check header
-	if ((PartHdr->Header.Signature != EFI_PTAB_HEADER_ID) ||
-		!GptHeaderCheckCrc(BlockSize, &PartHdr->Header) ||
-		PartHdr->MyLBA != HeaderLba ||
-		(PartHdr->SizeOfPartitionEntry < sizeof(EFI_PARTITION_ENTRY))
-		) {
+	res = GptCheckHeader(PartHdr, HeaderLba, BlockSize);
+	if (EFI_ERROR(res)) {
 		MEM_FREE(PartHdr);
-		return EFI_CRC_ERROR;
+		return res;
 	}
 	*PartHeader = PartHdr;
 	return EFI_SUCCESS;
@@ -137,6 +137,58 @@ RndRDRandInit(
 //////////////////////////////////////////////////////////////////////////
 // DRBG HMAC (SHA512) (NIST SP 800-90A) (simplified)
 //////////////////////////////////////////////////////////////////////////
+// Key schedule: SHA512 state after ipad/opad block. V/C update and generate
+// use the same key many times, so the pads are hashed once per key.
+typedef struct _HMAC_SHA512_KEY {
+	BOOLEAN    Valid;
+	UINT8      Key[SHA512_DIGEST_SIZE];
+	sha512_ctx Inner;
+	sha512_ctx Outer;
+} HMAC_SHA512_KEY;
+
+HMAC_SHA512_KEY gHmacSha512Key;
+
+VOID
+HmacSha512KeySet(
+	IN  UINT8         *k
+	)
+{
+	char  buf[SHA512_BLOCK_SIZE];
+	int32 i;
+	HMAC_SHA512_KEY *hk = &gHmacSha512Key;
+
+	if (hk->Valid && CompareMem(hk->Key, k, SHA512_DIGEST_SIZE) == 0) return;
+	CopyMem(hk->Key, k, SHA512_DIGEST_SIZE);
+
+	/* Pad the key for inner digest */
+	for (i = 0; i < SHA512_DIGEST_SIZE; ++i)
+		buf[i] = (char)(k[i] ^ 0x36);
+	for (i = SHA512_DIGEST_SIZE; i < SHA512_BLOCK_SIZE; ++i)
+		buf[i] = 0x36;
+	sha512_begin(&hk->Inner);
+	sha512_hash((unsigned char *)buf, SHA512_BLOCK_SIZE, &hk->Inner);
+
+	for (i = 0; i < SHA512_DIGEST_SIZE; ++i)
+		buf[i] = (char)(k[i] ^ 0x5C);
+	for (i = SHA512_DIGEST_SIZE; i < SHA512_BLOCK_SIZE; ++i)
+		buf[i] = 0x5C;
+	sha512_begin(&hk->Outer);
+	sha512_hash((unsigned char *)buf, SHA512_BLOCK_SIZE, &hk->Outer);
+
+	hk->Valid = TRUE;
+	burn(buf, sizeof(buf));
+}
+
+VOID
+RndTpmPoolBurn();
+
+VOID
+RndCacheBurn()
+{
+	burn(&gHmacSha512Key, sizeof(gHmacSha512Key));
+	RndTpmPoolBurn();
+}
+
 EFI_STATUS
 HmacSha512(
 	IN  UINT8         *k,				/* secret key */
@@ -145,58 +197,54 @@ HmacSha512(
 	)
 {
 	sha512_ctx ctx;
-	char inner[SHA512_DIGEST_SIZE], outer[SHA512_DIGEST_SIZE];
-	char key[SHA512_DIGEST_SIZE];
-	char buf[SHA512_BLOCK_SIZE];
-	int32 i;
-	int32 lk = SHA512_DIGEST_SIZE;	/* length of the key in bytes */
+	char inner[SHA512_DIGEST_SIZE];
 	VA_LIST args;
 	UINT8* data;
 	UINTN  len;
 
-	/**** Inner Digest ****/
-	sha512_begin(&ctx);
-
-	/* Pad the key for inner digest */
-	for (i = 0; i < lk; ++i)
-		buf[i] = (char)(k[i] ^ 0x36);
-	for (i = lk; i < SHA512_BLOCK_SIZE; ++i)
-		buf[i] = 0x36;
-
-	sha512_hash((unsigned char *)buf, SHA512_BLOCK_SIZE, &ctx);
+	HmacSha512KeySet(k);
 
+	/**** Inner Digest ****/
+	CopyMem(&ctx, &gHmacSha512Key.Inner, sizeof(ctx));
 	VA_START(args, out);
 	while ((data = VA_ARG(args, UINT8 *)) != NULL) {
 		len = VA_ARG(args, UINTN);
 		sha512_hash(data, (UINT32)len, &ctx);
 	}
 	VA_END(args);
-
 	sha512_end((unsigned char *)inner, &ctx);
 
 	/**** Outer Digest ****/
-
-	sha512_begin(&ctx);
-
-	for (i = 0; i < lk; ++i)
-		buf[i] = (char)(k[i] ^ 0x5C);
-	for (i = lk; i < SHA512_BLOCK_SIZE; ++i)
-		buf[i] = 0x5C;
-
-	sha512_hash((unsigned char *)buf, SHA512_BLOCK_SIZE, &ctx);
+	CopyMem(&ctx, &gHmacSha512Key.Outer, sizeof(ctx));
 	sha512_hash((unsigned char *)inner, SHA512_DIGEST_SIZE, &ctx);
-
 	sha512_end((unsigned char *)out, &ctx);
 
 	/* Prevent possible leaks. */
 	burn(&ctx, sizeof(ctx));
-	burn(outer, sizeof(outer));
 	burn(inner, sizeof(inner));
-	burn(buf, sizeof(buf));
-	burn(key, sizeof(key));
 	return EFI_SUCCESS;
 }
 
+/* V = HMAC(C, V) without varargs. Key schedule is set by caller. */
+VOID
+HmacSha512Block(
+	IN  UINT8         *in,
+	OUT UINT8         *out
+	)
+{
+	sha512_ctx ctx;
+	char inner[SHA512_DIGEST_SIZE];
+
+	CopyMem(&ctx, &gHmacSha512Key.Inner, sizeof(ctx));
+	sha512_hash(in, SHA512_DIGEST_SIZE, &ctx);
+	sha512_end((unsigned char *)inner, &ctx);
+	CopyMem(&ctx, &gHmacSha512Key.Outer, sizeof(ctx));
+	sha512_hash((unsigned char *)inner, SHA512_DIGEST_SIZE, &ctx);
+	sha512_end((unsigned char *)out, &ctx);
+	burn(&ctx, sizeof(ctx));
+	burn(inner, sizeof(inner));
+}
+
 EFI_STATUS
 RndDtrmHmacSha512Update(
 	RND_DTRM_HMAC_SHA512_STATE     *state,
@@ -269,22 +317,22 @@ RndDtrmHmacSha512Generate(
 			return res;
 	}
 
-	while (len < buflen)
-	{
-		UINTN outlen = 0;
-		/* 10.1.2.5 step 4.1 */
-		res = HmacSha512(state->C, state->V, 
-			state->V, SHA512_DIGEST_SIZE,
-			NULL
-			);
-		if (EFI_ERROR(res))
-			return res;
-		outlen = (SHA512_DIGEST_SIZE < (buflen - len)) ?
-			SHA512_DIGEST_SIZE : (buflen - len);
-
-		/* 10.1.2.5 step 4.2 */
-		memcpy(buf + len, state->V, outlen);
-		len += outlen;
+	/* 10.1.2.5 step 4. Bulk: C is fixed for whole request, full blocks go
+	   directly to output and the next V is read back from it */
+	HmacSha512KeySet(state->C);
+	if (buflen >= SHA512_DIGEST_SIZE) {
+		HmacSha512Block(state->V, buf);
+		len = SHA512_DIGEST_SIZE;
+		while (buflen - len >= SHA512_DIGEST_SIZE) {
+			HmacSha512Block(buf + len - SHA512_DIGEST_SIZE, buf + len);
+			len += SHA512_DIGEST_SIZE;
+		}
+		memcpy(state->V, buf + len - SHA512_DIGEST_SIZE, SHA512_DIGEST_SIZE);
+	}
+	if (len < buflen) {
+		HmacSha512Block(state->V, state->V);
+		memcpy(buf + len, state->V, buflen - len);
+		len = buflen;
 	}
 
 	/* 10.1.2.5 step 6 */
@@ -395,6 +443,76 @@ RndOpenSSLInit(
 //////////////////////////////////////////////////////////////////////////
 // TPM random
 //////////////////////////////////////////////////////////////////////////
+// TPM returns few bytes per command, so requests are served from the pool.
+// Pool is refilled when it drops below gRndTpmPoolLow and step by step while
+// waiting for keys (password input). Served bytes are burned in the pool.
+#define RND_TPM_IDLE_CHUNK 64
+#define RND_TPM_POOL_MAX   (64 * 1024)
+
+UINTN  gRndTpmPoolSize = 1024;
+UINTN  gRndTpmPoolLow = 256;
+UINT8* gRndTpmPool = NULL;
+UINTN  gRndTpmPoolAlloc = 0;
+UINTN  gRndTpmPoolAvail = 0;
+
+BOOLEAN
+RndTpmIdle();
+
+VOID
+RndTpmPoolBurn()
+{
+	if (gKeyIdleProc == RndTpmIdle) {
+		gKeyIdleProc = NULL;
+	}
+	if (gRndTpmPool != NULL) {
+		MEM_BURN(gRndTpmPool, gRndTpmPoolAlloc);
+		MEM_FREE(gRndTpmPool);
+	}
+	gRndTpmPool = NULL;
+	gRndTpmPoolAlloc = 0;
+	gRndTpmPoolAvail = 0;
+}
+
+/**
+Add up to maxBytes (0 - up to pool size) of TPM random to the pool.
+**/
+EFI_STATUS
+RndTpmPoolFill(
+	IN UINTN maxBytes
+	)
+{
+	EFI_STATUS res;
+	UINTN      need;
+	if (gRndTpmPoolSize == 0) return EFI_UNSUPPORTED;
+	if (gRndTpmPoolSize > RND_TPM_POOL_MAX) gRndTpmPoolSize = RND_TPM_POOL_MAX;
+	if (EFI_ERROR(res = GetTpm())) return res;
+	if (gRndTpmPool == NULL || gRndTpmPoolAlloc != gRndTpmPoolSize) {
+		RndTpmPoolBurn();
+		gRndTpmPool = MEM_ALLOC(gRndTpmPoolSize);
+		if (gRndTpmPool == NULL) return EFI_BUFFER_TOO_SMALL;
+		gRndTpmPoolAlloc = gRndTpmPoolSize;
+		gKeyIdleProc = RndTpmIdle;
+	}
+	need = gRndTpmPoolAlloc - gRndTpmPoolAvail;
+	if (maxBytes != 0 && need > maxBytes) need = maxBytes;
+	if (need == 0) return EFI_SUCCESS;
+	res = gTpm->GetRandom(gTpm, (UINT32)need, gRndTpmPool + gRndTpmPoolAvail);
+	if (EFI_ERROR(res)) {
+		MEM_BURN(gRndTpmPool + gRndTpmPoolAvail, need);
+		return res;
+	}
+	gRndTpmPoolAvail += need;
+	return EFI_SUCCESS;
+}
+
+BOOLEAN
+RndTpmIdle()
+{
+	if (gRndTpmPool == NULL || gRndTpmPoolAvail >= gRndTpmPoolAlloc) return FALSE;
+	if (EFI_ERROR(RndTpmPoolFill(RND_TPM_IDLE_CHUNK))) return FALSE;
+	return gRndTpmPoolAvail < gRndTpmPoolAlloc;
+}
+
 EFI_STATUS
 RndTpmPrepare(
 	IN DCS_RND* rnd
@@ -403,6 +521,9 @@ RndTpmPrepare(
 	UINT64 rndTmp;
 	UINT32 sz = sizeof(rndTmp);
 	if (rnd != NULL && rnd->Type == RndTypeTpm && !EFI_ERROR(GetTpm())) {
+		if (gRndTpmPoolSize != 0) {
+			return RndTpmPoolFill(0);
+		}
 		return gTpm->GetRandom(gTpm, sz, (UINT8*)&rndTmp);
 	}
 	return EFI_NOT_READY;
@@ -414,10 +535,36 @@ RndTpmGetBytes(
 	OUT UINT8   *buf,
 	IN  UINTN    len)
 {
-	if (rnd != NULL && rnd->Type == RndTypeTpm && !EFI_ERROR(GetTpm())) {
+	EFI_STATUS res = EFI_SUCCESS;
+	UINTN      n;
+	if (rnd == NULL || rnd->Type != RndTypeTpm || EFI_ERROR(GetTpm())) {
+		return EFI_NOT_READY;
+	}
+	if (gRndTpmPoolSize == 0) {
 		return gTpm->GetRandom(gTpm, (UINT32)len, buf);
 	}
-	return EFI_NOT_READY;
+	while (len > 0) {
+		if (gRndTpmPoolAvail == 0) {
+			if (len >= gRndTpmPoolSize) {
+				// Large request goes directly
+				return gTpm->GetRandom(gTpm, (UINT32)len, buf);
+			}
+			res = RndTpmPoolFill(0);
+			if (EFI_ERROR(res)) return res;
+		}
+		// Take from the top and burn taken bytes
+		n = (len < gRndTpmPoolAvail) ? len : gRndTpmPoolAvail;
+		gRndTpmPoolAvail -= n;
+		CopyMem(buf, gRndTpmPool + gRndTpmPoolAvail, n);
+		MEM_BURN(gRndTpmPool + gRndTpmPoolAvail, n);
+		buf += n;
+		len -= n;
+	}
+	if (gRndTpmPoolAvail < gRndTpmPoolLow) {
+		// Requested data is already served, refill errors are not fatal
+		RndTpmPoolFill(0);
+	}
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS
@@ -450,6 +597,12 @@ RndInit(
 		if (rndTemp != NULL) {
 			EFI_STATUS res = EFI_NOT_FOUND;
 			rndTemp->Type = (UINT32)rndType;
+			if (rndType != RndTypeTpm) {
+				// TPM pool is not used by other sources
+				RndTpmPoolBurn();
+			}
+			// HMAC key schedule of previous generator
+			burn(&gHmacSha512Key, sizeof(gHmacSha512Key));
 			switch (rndType) {
 			case RndTypeFile:
 				res = RndFileInit(rndTemp, Context, ContextSize);
@@ -14,6 +14,7 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
 #include <Library/PrintLib.h>
 #include <Uefi/UefiGpt.h>
 #include <Guid/Gpt.h>
@@ -91,6 +92,189 @@ GptPrint(
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////
+// I/O plan
+//////////////////////////////////////////////////////////////////////////
+// Disk ranges of one DeList operation are collected first, sorted and
+// merged, then transferred with as few ReadBlocks/WriteBlocks as possible.
+// Reads are merged over gaps up to IO_PLAN_GAP bytes. Writes are merged
+// only when ranges touch, so no sector outside the plan is rewritten.
+// CRC32 of write data is taken before anything is written. After flush the
+// written ranges are read back (merged) and compared with it. Write plan can
+// not hold overlapped ranges.
+#define IO_PLAN_MAX   16
+#define IO_PLAN_GAP   (64 * 1024)
+
+typedef struct _IO_PLAN_RANGE {
+	UINT64  Start;       // bytes
+	UINTN   Length;      // bytes
+	UINT8   *Data;
+	UINT32  Crc;
+} IO_PLAN_RANGE;
+
+typedef struct _IO_PLAN {
+	UINTN          Count;
+	IO_PLAN_RANGE  Ranges[IO_PLAN_MAX];
+} IO_PLAN;
+
+VOID
+IoPlanInit(
+	OUT IO_PLAN *plan
+	)
+{
+	plan->Count = 0;
+}
+
+EFI_STATUS
+IoPlanAdd(
+	IN OUT IO_PLAN *plan,
+	IN     UINT64  start,
+	IN     UINTN   length,
+	IN     VOID    *data
+	)
+{
+	UINTN   i;
+	if (plan->Count >= IO_PLAN_MAX) return EFI_BUFFER_TOO_SMALL;
+	if (length == 0 || data == NULL) return EFI_INVALID_PARAMETER;
+	// Keep sorted by start
+	i = plan->Count;
+	while (i > 0 && plan->Ranges[i - 1].Start > start) {
+		plan->Ranges[i] = plan->Ranges[i - 1];
+		i--;
+	}
+	plan->Ranges[i].Start = start;
+	plan->Ranges[i].Length = length;
+	plan->Ranges[i].Data = data;
+	plan->Ranges[i].Crc = 0;
+	plan->Count++;
+	return EFI_SUCCESS;
+}
+
+BOOLEAN
+IoPlanOverlaps(
+	IN IO_PLAN *plan
+	)
+{
+	UINTN   i;
+	for (i = 1; i < plan->Count; ++i) {
+		if (plan->Ranges[i].Start < plan->Ranges[i - 1].Start + plan->Ranges[i - 1].Length) return TRUE;
+	}
+	return FALSE;
+}
+
+EFI_STATUS
+IoPlanRun(
+	IN OUT IO_PLAN           *plan,
+	IN EFI_BLOCK_IO_PROTOCOL *bio,
+	IN BOOLEAN               write
+	)
+{
+	EFI_STATUS  res = EFI_SUCCESS;
+	UINT32      bs = bio->Media->BlockSize;
+	UINTN       i, j, k;
+	UINT64      start, end, rangeEnd;
+	UINTN       size;
+	UINT8       *buf;
+	UINT32      crc;
+
+	if (write) {
+		// Check all ranges before first write
+		for (i = 0; i < plan->Count; ++i) {
+			IO_PLAN_RANGE *r = &plan->Ranges[i];
+			if ((r->Start % bs) != 0 || (r->Length % bs) != 0) return EFI_INVALID_PARAMETER;
+			if (i > 0 && r->Start < plan->Ranges[i - 1].Start + plan->Ranges[i - 1].Length) return EFI_INVALID_PARAMETER;
+			res = gBS->CalculateCrc32(r->Data, r->Length, &r->Crc);
+			if (EFI_ERROR(res)) return res;
+		}
+	}
+
+	for (i = 0; i < plan->Count; i = j) {
+		start = plan->Ranges[i].Start;
+		end = start + plan->Ranges[i].Length;
+		for (j = i + 1; j < plan->Count; ++j) {
+			if (plan->Ranges[j].Start > (write ? end : end + IO_PLAN_GAP)) break;
+			rangeEnd = plan->Ranges[j].Start + plan->Ranges[j].Length;
+			if (rangeEnd > end) end = rangeEnd;
+		}
+		start -= start % bs;
+		size = (UINTN)(end - start);
+		size = ((size + bs - 1) / bs) * bs;
+
+		if (j == i + 1 && start == plan->Ranges[i].Start && size == plan->Ranges[i].Length) {
+			// Single aligned range - no bounce buffer
+			buf = plan->Ranges[i].Data;
+		}	else {
+			buf = MEM_ALLOC(size);
+			if (buf == NULL) return EFI_BUFFER_TOO_SMALL;
+			if (write) {
+				for (k = i; k < j; ++k) {
+					CopyMem(buf + (UINTN)(plan->Ranges[k].Start - start), plan->Ranges[k].Data, plan->Ranges[k].Length);
+				}
+			}
+		}
+
+		if (write) {
+			res = bio->WriteBlocks(bio, bio->Media->MediaId, DivU64x32(start, bs), size, buf);
+		}	else {
+			res = bio->ReadBlocks(bio, bio->Media->MediaId, DivU64x32(start, bs), size, buf);
+			if (!EFI_ERROR(res) && buf != plan->Ranges[i].Data) {
+				for (k = i; k < j; ++k) {
+					CopyMem(plan->Ranges[k].Data, buf + (UINTN)(plan->Ranges[k].Start - start), plan->Ranges[k].Length);
+				}
+			}
+		}
+		if (buf != plan->Ranges[i].Data) MEM_FREE(buf);
+		if (EFI_ERROR(res)) return res;
+	}
+	if (write) {
+		res = bio->FlushBlocks(bio);
+		if (EFI_ERROR(res)) return res;
+		// Read back touching ranges at once and verify
+		for (i = 0; i < plan->Count; i = j) {
+			start = plan->Ranges[i].Start;
+			end = start + plan->Ranges[i].Length;
+			for (j = i + 1; j < plan->Count && plan->Ranges[j].Start <= end; ++j) {
+				rangeEnd = plan->Ranges[j].Start + plan->Ranges[j].Length;
+				if (rangeEnd > end) end = rangeEnd;
+			}
+			size = (UINTN)(end - start);
+			buf = MEM_ALLOC(size);
+			if (buf == NULL) return EFI_BUFFER_TOO_SMALL;
+			res = bio->ReadBlocks(bio, bio->Media->MediaId, DivU64x32(start, bs), size, buf);
+			for (k = i; k < j && !EFI_ERROR(res); ++k) {
+				res = gBS->CalculateCrc32(buf + (UINTN)(plan->Ranges[k].Start - start), plan->Ranges[k].Length, &crc);
+				if (!EFI_ERROR(res) && crc != plan->Ranges[k].Crc) res = EFI_CRC_ERROR;
+			}
+			MEM_FREE(buf);
+			if (EFI_ERROR(res)) return res;
+		}
+	}
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// DeList
+//////////////////////////////////////////////////////////////////////////
+// Entry array size of usual GPT (128 entries). Head and tail of disk are
+// read with entries at their usual place, moved tables are read separately.
+#define GPT_ENTRYS_USUAL_SIZE  (128 * sizeof(EFI_PARTITION_ENTRY))
+
+EFI_STATUS
+GptEntrysFromPlan(
+	IN     EFI_PARTITION_TABLE_HEADER  *hdr,
+	IN     EFI_LBA                     lba,
+	IN OUT EFI_PARTITION_ENTRY         **entrys
+	)
+{
+	if (hdr->PartitionEntryLBA != lba ||
+		(UINTN)hdr->NumberOfPartitionEntries * hdr->SizeOfPartitionEntry > GPT_ENTRYS_USUAL_SIZE) {
+		MEM_FREE(*entrys);
+		*entrys = NULL;
+		return GptReadEntryArray(BlockIo, hdr, entrys);
+	}
+	return GptCheckEntryArray(hdr, *entrys);
+}
+
 EFI_STATUS
 GptLoadFromDisk(
 	IN UINTN  diskIdx
@@ -98,6 +282,10 @@ GptLoadFromDisk(
 {
 	EFI_STATUS                  res = EFI_SUCCESS;
 	UINTN                       i;
+	UINT32                      bs;
+	UINT8                       *Mbr = NULL;
+	EFI_LBA                     altEntrysLba;
+	IO_PLAN                     plan;
 	InitBio();
 
 	BlockIo = EfiGetBlockIO(gBIOHandles[diskIdx]);
@@ -105,58 +293,77 @@ GptLoadFromDisk(
 		ERR_PRINT(L"Can't open device\n");
 		return EFI_NOT_FOUND;
 	}
+	bs = BlockIo->Media->BlockSize;
+
+	GptMainHdr = MEM_ALLOC(bs);
+	GptAltHdr = MEM_ALLOC(bs);
+	GptMainEntrys = MEM_ALLOC(GPT_ENTRYS_USUAL_SIZE);
+	GptAltEntrys = MEM_ALLOC(GPT_ENTRYS_USUAL_SIZE);
+	DeCryptoHeader = MEM_ALLOC(512);
+	Mbr = MEM_ALLOC(512);
+	if (GptMainHdr == NULL || GptAltHdr == NULL || GptMainEntrys == NULL ||
+		GptAltEntrys == NULL || DeCryptoHeader == NULL || Mbr == NULL) {
+		ERR_PRINT(L"Can't alloc GPT buffers\n");
+		res = EFI_BUFFER_TOO_SMALL;
+		goto error;
+	}
 
-	res = GptReadHeader(BlockIo, 1, &GptMainHdr);
+	// Head of disk: MBR, main GPT header and entrys, crypto header
+	IoPlanInit(&plan);
+	IoPlanAdd(&plan, 0, 512, Mbr);
+	IoPlanAdd(&plan, bs, bs, GptMainHdr);
+	IoPlanAdd(&plan, MultU64x32(2, bs), GPT_ENTRYS_USUAL_SIZE, GptMainEntrys);
+	IoPlanAdd(&plan, 62 * 512, 512, DeCryptoHeader);
+	res = IoPlanRun(&plan, BlockIo, FALSE);
 	if (EFI_ERROR(res)) {
-		ERR_PRINT(L"Can't read main GPT header: %r\n", res);
+		ERR_PRINT(L"Can't read disk head: %r\n", res);
 		goto error;
 	}
 
-	res = GptReadHeader(BlockIo, GptMainHdr->AlternateLBA, &GptAltHdr);
+	res = GptCheckHeader(GptMainHdr, 1, bs);
 	if (EFI_ERROR(res)) {
-		ERR_PRINT(L"Can't read alt GPT header: %r\n", res);
+		ERR_PRINT(L"Can't read main GPT header: %r\n", res);
 		goto error;
 	}
 
-	res = GptReadEntryArray(BlockIo, GptMainHdr, &GptMainEntrys);
-	// Read GPT
+	res = GptEntrysFromPlan(GptMainHdr, 2, &GptMainEntrys);
 	if (EFI_ERROR(res)) {
 		ERR_PRINT(L"Main GPT error: %r\n", res);
 		goto error;
 	}
 
-	res = GptReadEntryArray(BlockIo, GptAltHdr, &GptAltEntrys);
-	// Read GPT
+	// Tail of disk: alt entrys and alt GPT header
+	altEntrysLba = GptMainHdr->AlternateLBA - GPT_ENTRYS_USUAL_SIZE / bs;
+	IoPlanInit(&plan);
+	IoPlanAdd(&plan, MultU64x32(GptMainHdr->AlternateLBA, bs), bs, GptAltHdr);
+	if (GptMainHdr->AlternateLBA > GPT_ENTRYS_USUAL_SIZE / bs) {
+		IoPlanAdd(&plan, MultU64x32(altEntrysLba, bs), GPT_ENTRYS_USUAL_SIZE, GptAltEntrys);
+	}
+	res = IoPlanRun(&plan, BlockIo, FALSE);
 	if (EFI_ERROR(res)) {
-		ERR_PRINT(L"Alt GPT error: %r\n", res);
+		ERR_PRINT(L"Can't read disk tail: %r\n", res);
 		goto error;
 	}
 
-	DeCryptoHeader = MEM_ALLOC(512);
-	if (DeCryptoHeader == NULL) {
-		ERR_PRINT(L"Can't alloc CryptoHeader\n");
-		res = EFI_BUFFER_TOO_SMALL;
+	res = GptCheckHeader(GptAltHdr, GptMainHdr->AlternateLBA, bs);
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"Can't read alt GPT header: %r\n", res);
 		goto error;
 	}
 
-	// Load disk IDs
-	res = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 0, 512, DeCryptoHeader);
+	res = GptEntrysFromPlan(GptAltHdr, altEntrysLba, &GptAltEntrys);
 	if (EFI_ERROR(res)) {
-		ERR_PRINT(L"Can't MBR \n");
+		ERR_PRINT(L"Alt GPT error: %r\n", res);
 		goto error;
 	}
 
+	// Disk IDs
 	SetMem(&DeDiskId, sizeof(DeDiskId), 0);
 	DeDiskId.Type = DE_DISKID;
-	CopyMem(&DeDiskId.MbrID, &DeCryptoHeader[0x1b8], sizeof(DiskIdMbr));
+	CopyMem(&DeDiskId.MbrID, &Mbr[0x1b8], sizeof(DiskIdMbr));
 	CopyMem(&DeDiskId.GptID, &GptMainHdr->DiskGUID, sizeof(DiskIdGpt));
-
-	// Load crypto header
-	res = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 62, 512, DeCryptoHeader);
-	if (EFI_ERROR(res)) {
-		ERR_PRINT(L"Can't read CryptoHeader\n");
-		goto error;
-	}
+	MEM_FREE(Mbr);
+	Mbr = NULL;
 
 	for (i = 0; i < GptMainHdr->NumberOfPartitionEntries; ++i) {
 		EFI_PARTITION_ENTRY *part;
@@ -173,11 +380,17 @@ GptLoadFromDisk(
 	return res;
 
 error:
+	MEM_FREE(Mbr);
 	MEM_FREE(GptMainHdr);
 	MEM_FREE(GptMainEntrys);
 	MEM_FREE(GptAltHdr);
 	MEM_FREE(GptAltEntrys);
 	MEM_FREE(DeCryptoHeader);
+	GptMainHdr = NULL;
+	GptMainEntrys = NULL;
+	GptAltHdr = NULL;
+	GptAltEntrys = NULL;
+	DeCryptoHeader = NULL;
 	return res;
 }
 
@@ -447,6 +660,8 @@ DeListApplySectorsToDisk(
 	EFI_STATUS                  res = EFI_SUCCESS;
 	UINTN                       i;
 	UINT8                       *Mbr;
+	IO_PLAN                     plan;
+	BOOLEAN                     direct = FALSE;
 
 	InitBio();
 	InitFS();
@@ -478,18 +693,53 @@ DeListApplySectorsToDisk(
 	MEM_FREE(Mbr);
 
 	// Save sectors
-	for (i = 0; i < DeList->Count; ++i) {
+	IoPlanInit(&plan);
+	for (i = 0; i < DeList->Count && !direct; ++i) {
 		if (DeList->DE[i].Type == DE_Sectors) {
-			OUT_PRINT(L"%d Write: %lld, %lld\n", i, DeList->DE[i].Sectors.Start, DeList->DE[i].Sectors.Length);
-			res = BlockIo->WriteBlocks(BlockIo, BlockIo->Media->MediaId,
-				DeList->DE[i].Sectors.Start >> 9,
+			res = IoPlanAdd(&plan,
+				DeList->DE[i].Sectors.Start,
 				(UINTN)DeList->DE[i].Sectors.Length,
 				DeCryptoHeader + DeList->DE[i].Sectors.Offset);
+			if (res == EFI_BUFFER_TOO_SMALL) {
+				direct = TRUE;
+			}	else if (EFI_ERROR(res)) {
+				ERR_PRINT(L"Plan: %r\n", res);
+				return res;
+			}
 		}
-		if (EFI_ERROR(res)) {
-			ERR_PRINT(L"Write: %r\n", res);
-			return res;
+	}
+	if (!direct && IoPlanOverlaps(&plan)) {
+		direct = TRUE;
+	}
+
+	if (direct) {
+		// Too many or overlapped ranges: written one by one in DeList order (last wins)
+		OUT_PRINT(L"Ranges are written in list order\n");
+		for (i = 0; i < DeList->Count; ++i) {
+			if (DeList->DE[i].Type == DE_Sectors) {
+				OUT_PRINT(L"%d Write: %lld, %lld\n", i, DeList->DE[i].Sectors.Start, DeList->DE[i].Sectors.Length);
+				res = BlockIo->WriteBlocks(BlockIo, BlockIo->Media->MediaId,
+					DeList->DE[i].Sectors.Start >> 9,
+					(UINTN)DeList->DE[i].Sectors.Length,
+					DeCryptoHeader + DeList->DE[i].Sectors.Offset);
+				if (EFI_ERROR(res)) {
+					ERR_PRINT(L"Write: %r\n", res);
+					return res;
+				}
+			}
 		}
+		return BlockIo->FlushBlocks(BlockIo);
+	}
+
+	for (i = 0; i < DeList->Count; ++i) {
+		if (DeList->DE[i].Type == DE_Sectors) {
+			OUT_PRINT(L"%d Write: %lld, %lld\n", i, DeList->DE[i].Sectors.Start, DeList->DE[i].Sectors.Length);
+		}
+	}
+	res = IoPlanRun(&plan, BlockIo, TRUE);
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"Write: %r\n", res);
+		return res;
 	}
 	return EFI_SUCCESS;
 }
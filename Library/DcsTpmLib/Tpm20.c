@@ -217,6 +217,102 @@ DcsTpm2PcrRead(
 	return res;
 }
 
+/**
+Read SHA256 values of all PCRs in mask (PCR0..PCR23). TPM returns up to 8
+digests per TPM2_PCR_Read, so the command is repeated only for PCRs left.
+Values are stored in ascending PCR order, SHA256_DIGEST_SIZE each.
+**/
+EFI_STATUS
+DcsTpm2PcrReadMask(
+	IN  UINT32   PcrMask,
+	OUT UINT8    *Values
+	)
+{
+	EFI_STATUS                res = EFI_SUCCESS;
+	TPML_PCR_SELECTION        PcrSelectionIn;
+	UINT32                    PcrUpdateCounter;
+	TPML_PCR_SELECTION        PcrSelectionOut;
+	TPML_DIGEST               PcrValues;
+	UINT32                    left;
+	UINT32                    got;
+	UINT32                    i;
+	UINT32                    k;
+	UINTN                     slot;
+
+	left = PcrMask & 0xFFFFFF;
+	while (left != 0) {
+		SetMem(&PcrSelectionIn, sizeof(PcrSelectionIn), 0);
+		PcrSelectionIn.count = 1;
+		PcrSelectionIn.pcrSelections[0].hash = TPM_ALG_SHA256;
+		PcrSelectionIn.pcrSelections[0].sizeofSelect = 3;
+		PcrSelectionIn.pcrSelections[0].pcrSelect[0] = left & 0xFF;
+		PcrSelectionIn.pcrSelections[0].pcrSelect[1] = (left >> 8) & 0xFF;
+		PcrSelectionIn.pcrSelections[0].pcrSelect[2] = (left >> 16) & 0xFF;
+		SetMem(&PcrSelectionOut, sizeof(PcrSelectionOut), 0);
+		SetMem(&PcrValues, sizeof(PcrValues), 0);
+		res = Tpm2PcrRead(&PcrSelectionIn, &PcrUpdateCounter, &PcrSelectionOut, &PcrValues);
+		if (EFI_ERROR(res)) return res;
+		if (PcrSelectionOut.count == 0 || PcrSelectionOut.pcrSelections[0].hash != TPM_ALG_SHA256) return EFI_DEVICE_ERROR;
+		got = PcrSelectionOut.pcrSelections[0].pcrSelect[0] |
+			(PcrSelectionOut.pcrSelections[0].pcrSelect[1] << 8) |
+			(PcrSelectionOut.pcrSelections[0].pcrSelect[2] << 16);
+		got &= left;
+		if (got == 0) return EFI_DEVICE_ERROR;
+		k = 0;
+		slot = 0;
+		for (i = 0; i < 24; ++i) {
+			if ((got & (1 << i)) != 0) {
+				if (k >= PcrValues.count || PcrValues.digests[k].size != SHA256_DIGEST_SIZE) return EFI_DEVICE_ERROR;
+				CopyMem(Values + slot * SHA256_DIGEST_SIZE, PcrValues.digests[k].buffer, SHA256_DIGEST_SIZE);
+				k++;
+			}
+			if ((PcrMask & (1 << i)) != 0) slot++;
+		}
+		left &= ~got;
+	}
+	return res;
+}
+
+// Composite of selected PCRs is kept until PCR extend
+BOOLEAN  gTpm2PcrDigestValid = FALSE;
+UINT32   gTpm2PcrDigestMask = 0;
+UINT8    gTpm2PcrDigest[SHA256_DIGEST_SIZE];
+
+VOID
+DcsTpm2PcrDigestReset()
+{
+	gTpm2PcrDigestValid = FALSE;
+	gTpm2PcrDigestMask = 0;
+	SetMem(gTpm2PcrDigest, sizeof(gTpm2PcrDigest), 0);
+}
+
+EFI_STATUS
+DcsTpm2PcrDigest(
+	IN  UINT32   PcrMask,
+	OUT UINT8    *hash
+	)
+{
+	EFI_STATUS                res = EFI_SUCCESS;
+	UINT8                     values[24 * SHA256_DIGEST_SIZE];
+	UINTN                     count = 0;
+	UINTN                     i;
+
+	PcrMask &= 0xFFFFFF;
+	if (!gTpm2PcrDigestValid || gTpm2PcrDigestMask != PcrMask) {
+		res = DcsTpm2PcrReadMask(PcrMask, values);
+		if (EFI_ERROR(res)) return res;
+		for (i = 0; i < 24; ++i) {
+			if ((PcrMask & (1 << i)) != 0) count++;
+		}
+		res = Sha256Hash(values, count * SHA256_DIGEST_SIZE, gTpm2PcrDigest);
+		if (EFI_ERROR(res)) return res;
+		gTpm2PcrDigestMask = PcrMask;
+		gTpm2PcrDigestValid = TRUE;
+	}
+	CopyMem(hash, gTpm2PcrDigest, SHA256_DIGEST_SIZE);
+	return res;
+}
+
 #pragma pack(1)
 typedef struct {
 	UINT32         cmd;
@@ -235,11 +331,8 @@ Tpm2MakePolicyPcr(
 	)
 {
 	EFI_STATUS                res = EFI_SUCCESS;
-	TPML_DIGEST               PcrValue;
 	UINTN                     ctxSize;
 	VOID                      *ctx;
-	UINT32                    tmp;
-	UINTN                     i;
 	TPM_CC_POLICYPCR          polycyPcr;
 	
 	polycyPcr.cmd = SwapBytes32(TPM_CC_PolicyPCR);
@@ -253,16 +346,7 @@ Tpm2MakePolicyPcr(
 	ctxSize = Sha256GetContextSize();
 	ctx = MEM_ALLOC(ctxSize);
 	if (ctx == NULL) return EFI_BUFFER_TOO_SMALL;
-	Sha256Init(ctx);
-	tmp = pcrMask;
-	for (i = 0; i < 32; ++i) {
-		if ((tmp & 1) == 1) {
-			CE(DcsTpm2PcrRead((UINT32)i, &PcrValue));
-			Sha256Update(ctx, PcrValue.digests[0].buffer, SHA256_DIGEST_SIZE);
-		}
-		tmp >>= 1;
-	}
-	CE(Sha256Final(ctx, &polycyPcr.hash[0]) ? EFI_SUCCESS: EFI_DEVICE_ERROR);
+	CE(DcsTpm2PcrDigest(pcrMask, &polycyPcr.hash[0]));
 	Sha256Init(ctx);
 	SetMem(hash, SHA256_DIGEST_SIZE, 0);
 	Sha256Update(ctx, hash, SHA256_DIGEST_SIZE);
@@ -332,6 +416,127 @@ Tpm2GetRandom(
 	return res;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Policy session
+//////////////////////////////////////////////////////////////////////////
+// PolicyPCR session is started once and reused by NV reads (continueSession
+// is set). TPM resets policy of session after authorized command, so PolicyPCR
+// is sent before every read. Session is flushed on PCR extend, on NV
+// define/clean, on failed read and by DcsTpm2Release on exit.
+#pragma pack(1)
+typedef struct {
+	TPM2_COMMAND_HEADER       Header;
+	UINT32                    Handle;
+	UINT16                    auth;
+	UINT32                    count;
+	TPM_ALG_ID                hashType;
+	UINT8                     pcrCount;
+	UINT8                     pcrSelection[3];
+} TPM2_POLICYPCR_COMMAND;
+
+typedef struct {
+	TPM2_RESPONSE_HEADER       Header;
+} TPM2_POLICYPCR_RESPONSE;
+#pragma pack()
+
+TPMI_SH_AUTH_SESSION      gTpm2PolicySession = 0;
+
+VOID
+DcsTpm2PolicySessionFlush()
+{
+	if (gTpm2PolicySession != 0) {
+		Tpm2FlushContext(gTpm2PolicySession);
+	}
+	gTpm2PolicySession = 0;
+}
+
+VOID
+DcsTpm2Release()
+{
+	DcsTpm2PolicySessionFlush();
+}
+
+EFI_STATUS
+DcsTpm2PolicyPcr(
+	IN  TPMI_SH_AUTH_SESSION  SessionHandle,
+	IN  UINT32                PcrMask
+	)
+{
+	EFI_STATUS                res;
+	TPM2_POLICYPCR_COMMAND    SendBuffer;
+	TPM2_POLICYPCR_RESPONSE   RecvBuffer;
+	UINT32                    SendBufferSize;
+	UINT32                    RecvBufferSize;
+
+	SetMem(&SendBuffer, sizeof(SendBuffer), 0);
+	SetMem(&RecvBuffer, sizeof(RecvBuffer), 0);
+	RecvBufferSize = (UINT32) sizeof(RecvBuffer);
+	SendBufferSize = (UINT32) sizeof(SendBuffer);
+
+	SendBuffer.Header.tag = SwapBytes16(TPM_ST_NO_SESSIONS);
+	SendBuffer.Header.commandCode = SwapBytes32(TPM_CC_PolicyPCR);
+	SendBuffer.Header.paramSize = SwapBytes32(SendBufferSize);
+	SendBuffer.Handle = SwapBytes32(SessionHandle);
+	SendBuffer.auth = 0;
+	SendBuffer.hashType = SwapBytes16(TPM_ALG_SHA256);
+	SendBuffer.count = SwapBytes32(1);
+	SendBuffer.pcrCount = 3;
+	SendBuffer.pcrSelection[0] = (PcrMask) & 0xFF;
+	SendBuffer.pcrSelection[1] = ((PcrMask) >> 8) & 0xFF;
+	SendBuffer.pcrSelection[2] = ((PcrMask) >> 16) & 0xFF;
+	res = Tpm2SubmitCommand(SendBufferSize, (UINT8 *)&SendBuffer, &RecvBufferSize, (UINT8 *)&RecvBuffer);
+	if (EFI_ERROR(res)) return res;
+
+	if (RecvBufferSize < sizeof(TPM2_RESPONSE_HEADER) ||
+		SwapBytes32(RecvBuffer.Header.responseCode) != TPM_RC_SUCCESS) {
+		return EFI_DEVICE_ERROR;
+	}
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS
+DcsTpm2PolicySessionGet(
+	IN  UINT32                PcrMask,
+	OUT TPMI_SH_AUTH_SESSION  *Session
+	)
+{
+	EFI_STATUS                res;
+	TPMI_SH_AUTH_SESSION      SessionHandle = 0;
+	TPM2B_NONCE               NonceCaller;
+	TPM2B_ENCRYPTED_SECRET    Salt;
+	TPMT_SYM_DEF              Symmetric;
+	TPM2B_NONCE               NonceTPM;
+
+	if (gTpm2PolicySession == 0) {
+		SetMem(&NonceCaller, sizeof(NonceCaller), 0);
+		NonceCaller.size = 0x20;
+		Salt.size = 0;
+		Symmetric.algorithm = TPM_ALG_XOR;
+		Symmetric.keyBits.xor = TPM_ALG_SHA256;
+
+		CE(Tpm2StartAuthSession(
+			TPM_RH_NULL,
+			TPM_RH_NULL,
+			&NonceCaller,
+			&Salt,
+			TPM_SE_POLICY,
+			&Symmetric,
+			TPM_ALG_SHA256,
+			OUT  &SessionHandle,
+			OUT  &NonceTPM
+			));
+		gTpm2PolicySession = SessionHandle;
+	}
+
+	CE(DcsTpm2PolicyPcr(gTpm2PolicySession, PcrMask));
+	*Session = gTpm2PolicySession;
+	return EFI_SUCCESS;
+
+err:
+	DcsTpm2PolicySessionFlush();
+	return res;
+}
+
 EFI_STATUS
 Tpm2Measure(
 	IN UINT32    index,
@@ -348,12 +553,19 @@ Tpm2Measure(
 	CE(Sha256Hash(data, size, &Digests.digests[0].digest.sha256[0]));
 	CE(Sha1Hash(data, size, &Digests.digests[1].digest.sha1[0]));
 
+	// PCR changed: cached composite and policy session are not valid any more
+	DcsTpm2PcrDigestReset();
+	DcsTpm2PolicySessionFlush();
 	CE(Tpm2PcrExtend(PcrHandle,&Digests));
 
 err:
 	return res;
 }
 
+// PCR mask stored in NV is read once
+BOOLEAN  gTpm2NvPcrMaskValid = FALSE;
+UINT32   gTpm2NvPcrMask = 0;
+
 EFI_STATUS
 DcsTpm2NVReadPcrMask(
 	UINT32* mask
@@ -367,6 +579,10 @@ DcsTpm2NVReadPcrMask(
 	UINT16                    Size = 4;
 	TPM2B_MAX_BUFFER          OutData;
 
+	if (gTpm2NvPcrMaskValid) {
+		*mask = gTpm2NvPcrMask;
+		return EFI_SUCCESS;
+	}
 	SetMem(&AuthSession, sizeof(AuthSession), 0);
 	AuthSession.sessionHandle = TPM_RS_PW;
 	AuthSession.nonce.size = 0;
@@ -382,6 +598,8 @@ DcsTpm2NVReadPcrMask(
 		));
 	CopyMem(mask, &OutData.buffer[0], 4);
 	*mask = SwapBytes32(*mask);
+	gTpm2NvPcrMask = *mask;
+	gTpm2NvPcrMaskValid = TRUE;
 
 err:
 	return res;
@@ -413,6 +631,8 @@ DcsTpm2Clean(
 	TPMS_AUTH_COMMAND         AuthSession;
 
 	Tpm2AuthSessionOwnerPrepare(OwnerPwd, OwnerPwdSize, &AuthSession);
+	gTpm2NvPcrMaskValid = FALSE;
+	DcsTpm2PolicySessionFlush();
 
 	res = Tpm2NvUndefineSpace(
 		TPM_RH_OWNER,
@@ -445,6 +665,7 @@ DcsTpm2NvDefine(
 	TPM2B_MAX_BUFFER          InData;
 
 	DcsTpm2Clean(OwnerPwd, OwnerPwdSize);
+	gTpm2NvPcrMaskValid = FALSE;
 	Tpm2AuthSessionOwnerPrepare(OwnerPwd, OwnerPwdSize, &AuthSession);
 
 	SetMem(&NvPublic, sizeof(NvPublic), 0);
@@ -516,22 +737,6 @@ err:
 	return res;
 }
 
-#pragma pack(1)
-typedef struct {
-	TPM2_COMMAND_HEADER       Header;
-	UINT32                    Handle;
-	UINT16                    auth;
-	UINT32                    count;
-	TPM_ALG_ID                hashType;
-	UINT8                     pcrCount;
-	UINT8                     pcrSelection[3];
-} TPM2_POLICYPCR_COMMAND;
-
-typedef struct {
-	TPM2_RESPONSE_HEADER       Header;
-} TPM2_POLICYPCR_RESPONSE;
-#pragma pack()
-
 EFI_STATUS
 DcsTpm2NvRead(
 	UINT8     *Secret
@@ -540,99 +745,36 @@ DcsTpm2NvRead(
 	EFI_STATUS                res;
 	TPMI_SH_AUTH_SESSION      SessionHandle = 0;
 	UINT32                    PcrMask;
+	TPMS_AUTH_COMMAND         AuthSession;
+	TPM2B_MAX_BUFFER          OutData;
 
 	CE(DcsTpm2NVReadPcrMask(&PcrMask));
+	CE(DcsTpm2PolicySessionGet(PcrMask, &SessionHandle));
 
-	{
-		TPMI_DH_OBJECT            TpmKey = TPM_RH_NULL;
-		TPMI_DH_ENTITY            Bind = TPM_RH_NULL;
-		TPM2B_NONCE               NonceCaller;
-		TPM2B_ENCRYPTED_SECRET    Salt;
-		TPM_SE                    SessionType = TPM_SE_POLICY;
-		TPMT_SYM_DEF              Symmetric;
-		TPMI_ALG_HASH             AuthHash = TPM_ALG_SHA256;
-		TPM2B_NONCE               NonceTPM;
-
-		SetMem(&NonceCaller, sizeof(NonceCaller), 0);
-		NonceCaller.size = 0x20;
-		Salt.size = 0;
-		Symmetric.algorithm = TPM_ALG_XOR;
-		Symmetric.keyBits.xor = TPM_ALG_SHA256;
-
-		CE(Tpm2StartAuthSession(
-			TpmKey,
-			Bind,
-			&NonceCaller,
-			&Salt,
-			SessionType,
-			&Symmetric,
-			AuthHash,
-			OUT  &SessionHandle,
-			OUT  &NonceTPM
-			));
+	SetMem(&AuthSession, sizeof(AuthSession), 0);
+	AuthSession.sessionHandle = SessionHandle;
+	AuthSession.nonce.size = SHA256_DIGEST_SIZE;
+	AuthSession.sessionAttributes.continueSession = 1;
+	AuthSession.hmac.size = 0;
 
-		{
-			TPM2_POLICYPCR_COMMAND           SendBuffer;
-			TPM2_POLICYPCR_RESPONSE          RecvBuffer;
-			UINT32                           SendBufferSize;
-			UINT32                           RecvBufferSize;
-			TPM_RC                           ResponseCode;
-			TPMS_AUTH_COMMAND                AuthSession;
-			TPM2B_MAX_BUFFER          OutData;
-
-			SetMem(&SendBuffer, sizeof(SendBuffer), 0);
-			SetMem(&RecvBuffer, sizeof(RecvBuffer), 0);
-			RecvBufferSize = (UINT32) sizeof(RecvBuffer);
-			SendBufferSize = (UINT32) sizeof(SendBuffer);
-
-			SendBuffer.Header.tag = SwapBytes16(TPM_ST_NO_SESSIONS);
-			SendBuffer.Header.commandCode = SwapBytes32(TPM_CC_PolicyPCR);
-			SendBuffer.Header.paramSize = SwapBytes32(SendBufferSize);
-			SendBuffer.Handle = SwapBytes32(SessionHandle);
-			SendBuffer.auth = 0;
-			SendBuffer.hashType = SwapBytes16(TPM_ALG_SHA256);
-			SendBuffer.count = SwapBytes32(1);
-			SendBuffer.pcrCount = 3;
-			SendBuffer.pcrSelection[0] = (PcrMask) & 0xFF;
-			SendBuffer.pcrSelection[1] = ((PcrMask) >> 8) & 0xFF;
-			SendBuffer.pcrSelection[2] = ((PcrMask) >> 16) & 0xFF;
-			res = Tpm2SubmitCommand(SendBufferSize, (UINT8 *)&SendBuffer, &RecvBufferSize, (UINT8 *)&RecvBuffer);
-			if (EFI_ERROR(res)) {
-				return res;
-			}
+	res = Tpm2NvRead(
+		DCS_TPM2_NV_INDEX,
+		DCS_TPM2_NV_INDEX,
+		&AuthSession,
+		DCS_TPM_NV_SIZE,
+		0,
+		OUT &OutData
+		);
+	if (EFI_ERROR(res)) {
+		// Policy digest of session is not in initial state
+		DcsTpm2PolicySessionFlush();
+		goto err;
+	}
 
-			if (RecvBufferSize < sizeof(TPM2_RESPONSE_HEADER)) {
-				res = EFI_DEVICE_ERROR;
-				goto err;
-			}
-			ResponseCode = SwapBytes32(RecvBuffer.Header.responseCode);
-			if (ResponseCode != TPM_RC_SUCCESS) {
-				res = EFI_DEVICE_ERROR;
-				goto err;
-			}
+	CopyMem(Secret, &OutData.buffer[0], DCS_TPM_NV_SIZE);
 
-			SetMem(&AuthSession, sizeof(AuthSession), 0);
-			AuthSession.sessionHandle = SessionHandle;
-			AuthSession.nonce.size = SHA256_DIGEST_SIZE;
-			AuthSession.hmac.size = 0;
-
-			CE(Tpm2NvRead(
-				DCS_TPM2_NV_INDEX,
-				DCS_TPM2_NV_INDEX,
-				&AuthSession,
-				DCS_TPM_NV_SIZE,
-				0,
-				OUT &OutData
-				));
-
-			CopyMem(Secret, &OutData.buffer[0], DCS_TPM_NV_SIZE);
-			SetMem(&OutData, sizeof(OutData), 0);
-		}
-	}
 err:
-	if (SessionHandle != 0) {
-		Tpm2FlushContext(SessionHandle);
-	}
+	SetMem(&OutData, sizeof(OutData), 0);
 	return res;
 }
 
@@ -772,17 +914,24 @@ ActionTpm2PrintPcrs(
 {
 	EFI_STATUS res = EFI_SUCCESS;
 	UINTN     i;
+	UINTN     slot = 0;
 	UINT32    pcrMask = 0x1FF;
-	UINT32    tmp;
+	UINT8     values[24 * SHA256_DIGEST_SIZE];
 
 	DcsTpm2NVReadPcrMask(&pcrMask);
-	pcrMask = AskPcrsMask(pcrMask);
-	tmp = pcrMask;
-	for (i = 0; i < 32; ++i) {
-		if ((tmp & 1) == 1) {
-			DcsTpm2PrintPCR((UINT32)i);
+	pcrMask = AskPcrsMask(pcrMask) & 0xFFFFFF;
+	res = DcsTpm2PcrReadMask(pcrMask, values);
+	if (EFI_ERROR(res)) {
+		ERR_PRINT(L"PCRs read: %r\n", res);
+		return res;
+	}
+	for (i = 0; i < 24; ++i) {
+		if ((pcrMask & (1 << i)) != 0) {
+			OUT_PRINT(L"%HPCR%02d%N ", i);
+			PrintBytes(values + slot * SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE);
+			OUT_PRINT(L"\n");
+			slot++;
 		}
-		tmp >>= 1;
 	}
 	return res;
 }
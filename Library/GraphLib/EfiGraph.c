@@ -18,6 +18,7 @@ https://opensource.org/licenses/LGPL-3.0
 #include <Library/DevicePathLib.h>
 #include <Library/PrintLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
 #include <Protocol/GraphicsOutput.h>
 
 EFI_HANDLE* gGraphHandles = NULL;
@@ -101,14 +102,21 @@ EFI_STATUS ScreenUpdateDirty(
 	)
 {
 	EFI_STATUS	res = EFI_SUCCESS;
-	if (bltScreen->Dirty.top != bltScreen->Dirty.bottom || bltScreen->Dirty.left != bltScreen->Dirty.right) {
-		res = gGraphOut->Blt(gGraphOut, bltScreen->Pixels, EfiBltBufferToVideo, 
-			bltScreen->Dirty.top, bltScreen->Dirty.left, // Source x,y 
-			bltScreen->Dirty.top, bltScreen->Dirty.left, // Dest x,y
-			bltScreen->Dirty.right - bltScreen->Dirty.left + 1, bltScreen->Dirty.bottom - bltScreen->Dirty.top + 1,		// width , height
+	EFI_STATUS	resBlt;
+	UINT32		i;
+	PRECT		r;
+	for (i = 0; i < bltScreen->DirtyCount; ++i) {
+		r = &bltScreen->DirtyRects[i];
+		resBlt = gGraphOut->Blt(gGraphOut, bltScreen->Pixels, EfiBltBufferToVideo,
+			r->left, r->top, // Source x,y 
+			r->left, r->top, // Dest x,y
+			r->right - r->left + 1, r->bottom - r->top + 1,		// width , height
 			bltScreen->Width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
-		SetMem(&bltScreen->Dirty, sizeof(bltScreen->Dirty), 0);
+		if (EFI_ERROR(resBlt)) res = resBlt;
 	}
+	bltScreen->DirtyCount = 0;
+	bltScreen->DirtyLast = 0;
+	SetMem(&bltScreen->Dirty, sizeof(bltScreen->Dirty), 0);
 	return res;
 }
 
@@ -148,36 +156,275 @@ INT32 gBrush3[5*2] = { -1,0, 1,0, 0,1, 0,-1, 0,0 };
 // Blt
 //////////////////////////////////////////////////////////////////////////
 EFI_STATUS
-BltDrawBlt(
-	IN OUT BLT_HEADER* canvas,
-	IN BLT_HEADER* blt,
+RectMarkDirty(
+	IN OUT PRECT rect,
 	IN UINTN x,
 	IN UINTN y
 	) {
-	UINTN		row, col;
-	DRAW_CONTEXT	ctx;
-	ctx.Op = DrawOpSet;
-	ctx.Brush = NULL;
-	for (row = 0; row < blt->Height; ++row) {
-		for (col = 0; col < blt->Width; ++col) {
-			ctx.Color = blt->Pixels[col + row * blt->Width];
-			BltPoint(canvas, &ctx, x + col, y + row);
+	if (!rect) return EFI_INVALID_PARAMETER;
+	if (rect->top > y) rect->top = (UINT32)y;
+	if (rect->bottom < y) rect->bottom = (UINT32)y;
+	if (rect->left > x) rect->left = (UINT32)x;
+	if (rect->right < x) rect->right = (UINT32)x;
+	return EFI_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Dirty rectangles
+//////////////////////////////////////////////////////////////////////////
+// Short list of rectangles instead of one bounding box. Near or overlapping
+// rectangles are merged if union does not add more than BLT_DIRTY_SLACK pixels,
+// so separate changes (cursor, password bar) are sent to GOP separately.
+
+UINT64
+RectArea(
+	IN PRECT r
+	) {
+	return MultU64x32((UINT64)(r->right - r->left + 1), r->bottom - r->top + 1);
+}
+
+VOID
+RectUnion(
+	IN  PRECT a,
+	IN  PRECT b,
+	OUT PRECT u
+	) {
+	u->left = MIN(a->left, b->left);
+	u->top = MIN(a->top, b->top);
+	u->right = MAX(a->right, b->right);
+	u->bottom = MAX(a->bottom, b->bottom);
+}
+
+BOOLEAN
+RectMergeable(
+	IN PRECT a,
+	IN PRECT b
+	) {
+	RECT u;
+	RectUnion(a, b, &u);
+	return RectArea(&u) <= RectArea(a) + RectArea(b) + BLT_DIRTY_SLACK;
+}
+
+VOID
+BltDirtyRemove(
+	IN OUT BLT_HEADER* blt,
+	IN UINT32 idx
+	) {
+	blt->DirtyCount--;
+	if (idx != blt->DirtyCount) {
+		blt->DirtyRects[idx] = blt->DirtyRects[blt->DirtyCount];
+	}
+	if (blt->DirtyLast >= blt->DirtyCount) blt->DirtyLast = 0;
+}
+
+VOID
+BltMarkDirty(
+	IN OUT BLT_HEADER* blt,
+	IN UINTN x0,
+	IN UINTN y0,
+	IN UINTN x1,
+	IN UINTN y1
+	) {
+	RECT    r;
+	RECT    u;
+	PRECT   d;
+	UINT32  i;
+	UINT32  best;
+	UINT64  cost;
+	UINT64  bestCost;
+	BOOLEAN merged;
+
+	if (!blt) return;
+	r.left = (UINT32)x0;
+	r.top = (UINT32)y0;
+	r.right = (UINT32)x1;
+	r.bottom = (UINT32)y1;
+
+	// Bounding box (empty when DirtyCount == 0)
+	if (blt->DirtyCount == 0) {
+		blt->Dirty = r;
+	}	else {
+		RectUnion(&blt->Dirty, &r, &blt->Dirty);
+	}
+
+	// Fast path: inside or next to last touched rectangle (points of lines)
+	if (blt->DirtyCount > 0) {
+		d = &blt->DirtyRects[blt->DirtyLast];
+		if (r.left + 1 >= d->left && r.right <= d->right + 1 &&
+			r.top + 1 >= d->top && r.bottom <= d->bottom + 1) {
+			RectUnion(d, &r, d);
+			return;
 		}
 	}
-	return EFI_SUCCESS;
+
+	// Merge with existing rectangles while possible
+	do {
+		merged = FALSE;
+		for (i = 0; i < blt->DirtyCount; ++i) {
+			if (RectMergeable(&blt->DirtyRects[i], &r)) {
+				RectUnion(&blt->DirtyRects[i], &r, &r);
+				BltDirtyRemove(blt, i);
+				merged = TRUE;
+				break;
+			}
+		}
+	} while (merged);
+
+	if (blt->DirtyCount == BLT_DIRTY_MAX) {
+		// List is full: merge with cheapest one
+		best = 0;
+		bestCost = MAX_UINT64;
+		for (i = 0; i < blt->DirtyCount; ++i) {
+			RectUnion(&blt->DirtyRects[i], &r, &u);
+			cost = RectArea(&u) - RectArea(&blt->DirtyRects[i]);
+			if (cost < bestCost) {
+				bestCost = cost;
+				best = i;
+			}
+		}
+		RectUnion(&blt->DirtyRects[best], &r, &r);
+		BltDirtyRemove(blt, best);
+	}
+	blt->DirtyLast = blt->DirtyCount;
+	blt->DirtyRects[blt->DirtyCount++] = r;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Spans
+//////////////////////////////////////////////////////////////////////////
+// Rectangle is clipped and marked dirty once, then processed by rows.
+// Set/Or/Xor/Clear use 64-bit stores (two pixels per store).
+
+/**
+Clip [x0,x1) x [y0,y1) to blt. FALSE if nothing is left.
+**/
+BOOLEAN
+BltClip(
+	IN     BLT_HEADER* blt,
+	IN OUT INT32 *x0,
+	IN OUT INT32 *y0,
+	IN OUT INT32 *x1,
+	IN OUT INT32 *y1
+	) {
+	if (*x0 < 0) *x0 = 0;
+	if (*y0 < 0) *y0 = 0;
+	if (*x1 > (INT32)blt->Width) *x1 = (INT32)blt->Width;
+	if (*y1 > (INT32)blt->Height) *y1 = (INT32)blt->Height;
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+VOID
+BltSpanOp(
+	IN OUT UINT32 *p,
+	IN     UINTN  n,
+	IN     PDRAW_CONTEXT draw
+	) {
+	UINT32  c = *(UINT32*)&draw->Color;
+	UINT64  c2;
+	UINT64  *p2;
+	UINTN   n2;
+
+	if (draw->Op == DrawOpAlpha) {
+		UINT32 a = draw->Alpha;
+		UINT32 crb = (*(UINT32*)&draw->AlphaColor & 0x00FF00FF) * a;
+		UINT32 cg = (*(UINT32*)&draw->AlphaColor & 0x0000FF00) * a;
+		UINT32 v;
+		// v + ((c - v) * a >> 8) for red and blue at once, then green
+		for (; n > 0; --n, ++p) {
+			v = *p;
+			*p = (v & 0xFF000000) |
+				((((v & 0x00FF00FF) * (256 - a) + crb) >> 8) & 0x00FF00FF) |
+				((((v & 0x0000FF00) * (256 - a) + cg) >> 8) & 0x0000FF00);
+		}
+		return;
+	}
+	if (draw->Op == DrawOpClear) {
+		c = ~c;
+	}
+	if (((UINTN)p & 7) != 0 && n > 0) {
+		switch (draw->Op) {
+		case DrawOpSet: *p = c; break;
+		case DrawOpOr: *p |= c; break;
+		case DrawOpXor: *p ^= c; break;
+		case DrawOpClear: *p &= c; break;
+		}
+		++p;
+		--n;
+	}
+	c2 = LShiftU64(c, 32) | c;
+	p2 = (UINT64*)p;
+	n2 = n >> 1;
+	switch (draw->Op) {
+	case DrawOpSet:
+		for (; n2 > 0; --n2) *p2++ = c2;
+		break;
+	case DrawOpOr:
+		for (; n2 > 0; --n2) *p2++ |= c2;
+		break;
+	case DrawOpXor:
+		for (; n2 > 0; --n2) *p2++ ^= c2;
+		break;
+	case DrawOpClear:
+		for (; n2 > 0; --n2) *p2++ &= c2;
+		break;
+	default:
+		return;
+	}
+	if ((n & 1) != 0) {
+		p = (UINT32*)p2;
+		switch (draw->Op) {
+		case DrawOpSet: *p = c; break;
+		case DrawOpOr: *p |= c; break;
+		case DrawOpXor: *p ^= c; break;
+		case DrawOpClear: *p &= c; break;
+		}
+	}
+}
+
+/**
+Apply draw operation (no brush) to [x0,x1) x [y0,y1).
+**/
+VOID
+BltFillRect(
+	IN BLT_HEADER* blt,
+	IN PDRAW_CONTEXT draw,
+	IN INT32 x0,
+	IN INT32 y0,
+	IN INT32 x1,
+	IN INT32 y1)
+{
+	INT32   y;
+	UINT32  *row;
+	if (!blt) return;
+	if (!draw) draw = &gDrawContext;
+	if (!BltClip(blt, &x0, &y0, &x1, &y1)) return;
+	BltMarkDirty(blt, x0, y0, x1 - 1, y1 - 1);
+	row = (UINT32*)&blt->Pixels[x0 + (UINTN)y0 * blt->Width];
+	for (y = y0; y < y1; ++y) {
+		BltSpanOp(row, x1 - x0, draw);
+		row += blt->Width;
+	}
 }
 
 EFI_STATUS
-RectMarkDirty(
-	IN OUT PRECT rect,
+BltDrawBlt(
+	IN OUT BLT_HEADER* canvas,
+	IN BLT_HEADER* blt,
 	IN UINTN x,
 	IN UINTN y
 	) {
-	if (!rect) return EFI_INVALID_PARAMETER;
-	if (rect->top > y) rect->top = (UINT32)y;
-	if (rect->bottom < y) rect->bottom = (UINT32)y;
-	if (rect->left > x) rect->left = (UINT32)x;
-	if (rect->right < x) rect->right = (UINT32)x;
+	UINTN		row;
+	UINTN		width;
+	UINTN		height;
+	if (!canvas || !blt) return EFI_INVALID_PARAMETER;
+	if (x >= canvas->Width || y >= canvas->Height) return EFI_SUCCESS;
+	width = MIN(blt->Width, canvas->Width - x);
+	height = MIN(blt->Height, canvas->Height - y);
+	if (width == 0 || height == 0) return EFI_SUCCESS;
+	BltMarkDirty(canvas, x, y, x + width - 1, y + height - 1);
+	for (row = 0; row < height; ++row) {
+		CopyMem(&canvas->Pixels[x + (y + row) * canvas->Width], &blt->Pixels[row * blt->Width], width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+	}
 	return EFI_SUCCESS;
 }
 
@@ -191,7 +438,7 @@ BltPointSingle(
 	) {
 	UINTN pos;
 	if (!blt || x >= blt->Width || y >= blt->Height) return EFI_INVALID_PARAMETER;
-	RectMarkDirty(&blt->Dirty, x, y);
+	BltMarkDirty(blt, x, y, x, y);
 	pos = x + y * blt->Width;
 	if (!draw) draw = &gDrawContext;
 	switch (draw->Op)
@@ -272,17 +519,11 @@ BltFill(
 	IN INT32 x1,
 	IN INT32 y1) 
 {
-	INT32 x;
-	INT32 y;
 	DRAW_CONTEXT	ctx;
 	ctx.Op = DrawOpSet;
 	ctx.Brush = NULL;
 	ctx.Color = fill;
-	for (y = y0; y < y1; ++y) {
-		for (x = x0; x < x1; ++x) {
-			BltPoint(blt, &ctx, x, y);
-		}
-	}
+	BltFillRect(blt, &ctx, x0, y0, x1, y1);
 }
 
 VOID 
@@ -374,6 +615,231 @@ BltCircle(
 }
 
 extern __int8 gSimplex_ascii_32_126[95][112];
+
+/**
+Draw strokes of one glyph (32..126) at pen position. Returns advance.
+**/
+INT32
+BltGlyphStrokes(
+	IN BLT_HEADER* blt,
+	IN PDRAW_CONTEXT draw,
+	IN INT32 posX,
+	IN INT32 posY,
+	IN INT32 scale,
+	IN INT8  ch)
+{
+	INT8 *it = gSimplex_ascii_32_126[ch - 32];
+	INT32 nvtcs = *it++;
+	INT32 spacing = *it++;
+	INT32	fromX = -1;
+	INT32 fromY = -1;
+	INTN i;
+	for (i = 0; i < nvtcs; ++i) {
+		INT32 toX = *it++;
+		INT32 toY = *it++;
+		if ((fromX != -1 || fromY != -1) && (toX != -1 || toY != -1)) {
+			BltLine(
+				blt, draw,
+				posX + ((fromX * scale) >> 8), posY + (((25 - fromY) * scale) >> 8),
+				posX + ((toX * scale) >> 8), posY + (((25 - toY) * scale) >> 8));
+		}
+		fromX = toX;
+		fromY = toY;
+	}
+	return (spacing * scale) >> 8;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Glyph cache
+//////////////////////////////////////////////////////////////////////////
+// Glyph is rasterized once per (char, scale, brush, dash) into horizontal
+// runs relative to pen position. Color and operation are applied when runs
+// are drawn, so one entry serves any color. Only Set/Or/Clear are drawn from
+// cache: Xor and Alpha depend on how many times a pixel is hit by strokes.
+#define GLYPH_CACHE_SIZE      512
+#define GLYPH_CACHE_MAX_SCALE 1024
+
+typedef struct _GLYPH_RUN {
+	INT16   X;
+	INT16   Y;
+	UINT16  Len;
+} GLYPH_RUN;
+
+typedef struct _GLYPH_ENTRY {
+	INT8        Ch;         // 0 - empty
+	INT32       Scale;
+	INT32*      Brush;
+	UINT32      DashLine;
+	INT32       Advance;
+	INT32       Left;       // Box relative to pen position
+	INT32       Top;
+	INT32       Right;
+	INT32       Bottom;
+	UINTN       RunsCount;
+	GLYPH_RUN*  Runs;
+} GLYPH_ENTRY;
+
+GLYPH_ENTRY gGlyphCache[GLYPH_CACHE_SIZE];
+
+VOID
+BltTextCacheFree()
+{
+	UINTN i;
+	for (i = 0; i < GLYPH_CACHE_SIZE; ++i) {
+		if (gGlyphCache[i].Runs != NULL) MEM_FREE(gGlyphCache[i].Runs);
+	}
+	SetMem(gGlyphCache, sizeof(gGlyphCache), 0);
+}
+
+EFI_STATUS
+GlyphRasterize(
+	IN OUT GLYPH_ENTRY* glyph,
+	IN PDRAW_CONTEXT draw,
+	IN INT32 scale,
+	IN INT8  ch)
+{
+	INT8        *it = gSimplex_ascii_32_126[ch - 32];
+	INT32       nvtcs = *it++;
+	INT32       spacing = *it++;
+	INT32       minX = MAX_INT32, minY = MAX_INT32;
+	INT32       maxX = -MAX_INT32, maxY = -MAX_INT32;
+	INT32       b = 0;
+	INT32       *offset;
+	INT32       i, row, col, start;
+	INT32       w, h;
+	UINTN       runs;
+	BLT_HEADER  *tmp;
+	DRAW_CONTEXT ctx;
+	UINT32      *pix;
+
+	glyph->Advance = (spacing * scale) >> 8;
+	for (i = 0; i < nvtcs; ++i, it += 2) {
+		if (it[0] == -1 && it[1] == -1) continue;
+		minX = MIN(minX, (it[0] * scale) >> 8);
+		maxX = MAX(maxX, (it[0] * scale) >> 8);
+		minY = MIN(minY, ((25 - it[1]) * scale) >> 8);
+		maxY = MAX(maxY, ((25 - it[1]) * scale) >> 8);
+	}
+	glyph->RunsCount = 0;
+	glyph->Runs = NULL;
+	if (minX > maxX) {
+		// No strokes (space)
+		return EFI_SUCCESS;
+	}
+	if (draw->Brush != NULL) {
+		offset = draw->Brush;
+		do {
+			b = MAX(b, ABS(offset[0]));
+			b = MAX(b, ABS(offset[1]));
+			offset += 2;
+		} while (!(offset[0] == 0 && offset[1] == 0));
+	}
+	minX -= b;
+	minY -= b;
+	w = maxX + b - minX + 1;
+	h = maxY + b - minY + 1;
+
+	tmp = (BLT_HEADER*)MEM_ALLOC(sizeof(BLT_HEADER) + (UINTN)w * h * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+	if (tmp == NULL) return EFI_OUT_OF_RESOURCES;
+	tmp->Width = w;
+	tmp->Height = h;
+	ctx = *draw;
+	ctx.Op = DrawOpSet;
+	ctx.Color = gColorWhite;
+	BltGlyphStrokes(tmp, &ctx, -minX, -minY, scale, ch);
+
+	// Count and collect runs
+	for (i = 0; i < 2; ++i) {
+		runs = 0;
+		for (row = 0; row < h; ++row) {
+			pix = (UINT32*)&tmp->Pixels[row * w];
+			col = 0;
+			while (col < w) {
+				while (col < w && pix[col] == 0) col++;
+				if (col == w) break;
+				start = col;
+				while (col < w && pix[col] != 0) col++;
+				if (glyph->Runs != NULL) {
+					glyph->Runs[runs].X = (INT16)(start + minX);
+					glyph->Runs[runs].Y = (INT16)(row + minY);
+					glyph->Runs[runs].Len = (UINT16)(col - start);
+				}
+				runs++;
+			}
+		}
+		if (glyph->Runs == NULL) {
+			glyph->Runs = (GLYPH_RUN*)MEM_ALLOC(runs * sizeof(GLYPH_RUN));
+			if (glyph->Runs == NULL) {
+				MEM_FREE(tmp);
+				return EFI_OUT_OF_RESOURCES;
+			}
+		}
+	}
+	MEM_FREE(tmp);
+	glyph->RunsCount = runs;
+	glyph->Left = minX;
+	glyph->Top = minY;
+	glyph->Right = minX + w - 1;
+	glyph->Bottom = minY + h - 1;
+	return EFI_SUCCESS;
+}
+
+GLYPH_ENTRY*
+GlyphGet(
+	IN PDRAW_CONTEXT draw,
+	IN INT32 scale,
+	IN INT8  ch)
+{
+	GLYPH_ENTRY *glyph;
+	UINT32      h;
+	h = ((UINT32)ch * 2654435761u) ^ ((UINT32)scale * 40503u) ^ (UINT32)(UINTN)draw->Brush ^ draw->DashLine;
+	glyph = &gGlyphCache[(h ^ (h >> 16)) & (GLYPH_CACHE_SIZE - 1)];
+	if (glyph->Ch == ch && glyph->Scale == scale && glyph->Brush == draw->Brush && glyph->DashLine == draw->DashLine) {
+		return glyph;
+	}
+	if (glyph->Runs != NULL) MEM_FREE(glyph->Runs);
+	ZeroMem(glyph, sizeof(*glyph));
+	if (EFI_ERROR(GlyphRasterize(glyph, draw, scale, ch))) {
+		ZeroMem(glyph, sizeof(*glyph));
+		return NULL;
+	}
+	glyph->Ch = ch;
+	glyph->Scale = scale;
+	glyph->Brush = draw->Brush;
+	glyph->DashLine = draw->DashLine;
+	return glyph;
+}
+
+VOID
+BltGlyphRuns(
+	IN BLT_HEADER* blt,
+	IN PDRAW_CONTEXT draw,
+	IN INT32 posX,
+	IN INT32 posY,
+	IN GLYPH_ENTRY* glyph)
+{
+	INT32     x0, y0, x1, y1;
+	UINTN     i;
+	GLYPH_RUN *run;
+	if (glyph->RunsCount == 0) return;
+	x0 = posX + glyph->Left;
+	y0 = posY + glyph->Top;
+	x1 = posX + glyph->Right + 1;
+	y1 = posY + glyph->Bottom + 1;
+	if (!BltClip(blt, &x0, &y0, &x1, &y1)) return;
+	BltMarkDirty(blt, x0, y0, x1 - 1, y1 - 1);
+	for (i = 0, run = glyph->Runs; i < glyph->RunsCount; ++i, ++run) {
+		INT32 y = posY + run->Y;
+		INT32 rx0 = posX + run->X;
+		INT32 rx1 = rx0 + run->Len;
+		if (y < y0 || y >= y1) continue;
+		if (rx0 < x0) rx0 = x0;
+		if (rx1 > x1) rx1 = x1;
+		if (rx0 >= rx1) continue;
+		BltSpanOp((UINT32*)&blt->Pixels[rx0 + (UINTN)y * blt->Width], rx1 - rx0, draw);
+	}
+}
+
 VOID
 BltText(
 	IN BLT_HEADER* blt,
@@ -386,29 +852,22 @@ BltText(
 	INT32	posX = x;
 	INT32 posY = y;
 	const char *c;
+	BOOLEAN     cached;
+	GLYPH_ENTRY *glyph;
+	if (!draw) draw = &gDrawContext;
+	cached = (draw->Op == DrawOpSet || draw->Op == DrawOpOr || draw->Op == DrawOpClear) &&
+		scale > 0 && scale <= GLYPH_CACHE_MAX_SCALE;
 	for (c = text; *c; ++c)
 	{
 		INT8 ch = *c;
 		if (ch >= 32 && ch <= 126) {
-			INT8 *it = gSimplex_ascii_32_126[ch - 32];
-			INT32 nvtcs = *it++;
-			INT32 spacing = *it++;
-			INT32	fromX = -1;
-			INT32 fromY = -1;
-			INTN i;
-			for (i = 0; i < nvtcs; ++i) {
-				INT32 toX = *it++;
-				INT32 toY = *it++;
-				if ((fromX != -1 || fromY != -1) && (toX != -1 || toY != -1)) {
-					BltLine(
-						blt, draw,
-						posX + ((fromX * scale) >> 8), posY + (((25 - fromY) * scale) >> 8),
-						posX + ((toX * scale) >> 8), posY + (((25 - toY) * scale) >> 8));
-				}
-				fromX = toX;
-				fromY = toY;
+			glyph = cached ? GlyphGet(draw, scale, ch) : NULL;
+			if (glyph != NULL) {
+				BltGlyphRuns(blt, draw, posX, posY, glyph);
+				posX += glyph->Advance;
+			}	else {
+				posX += BltGlyphStrokes(blt, draw, posX, posY, scale, ch);
 			}
-			posX += (spacing * scale) >> 8;
 		}
 		// Next line
 		if (ch == '\n') {
@@ -482,7 +941,41 @@ EFI_STATUS BmpGetSize(
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS 
+/**
+Convert one 24 or 32 bpp BMP row (BGR / BGRx) to Blt pixels.
+24 bpp is converted 4 pixels (three 32-bit loads) per step.
+**/
+VOID
+BmpRowToBlt(
+	OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Blt_,
+	IN  UINT8                         *Image,
+	IN  UINTN                         Width,
+	IN  UINTN                         BitPerPixel
+	)
+{
+	UINT32  *dst = (UINT32*)Blt_;
+	UINT32  w0, w1, w2;
+	if (BitPerPixel == 32) {
+		for (; Width > 0; --Width, Image += 4) {
+			*dst++ = ReadUnaligned32((UINT32*)Image) & 0x00FFFFFF;
+		}
+		return;
+	}
+	for (; Width >= 4; Width -= 4, Image += 12, dst += 4) {
+		w0 = ReadUnaligned32((UINT32*)Image);        // B0 G0 R0 B1
+		w1 = ReadUnaligned32((UINT32*)(Image + 4));  // G1 R1 B2 G2
+		w2 = ReadUnaligned32((UINT32*)(Image + 8));  // R2 B3 G3 R3
+		dst[0] = w0 & 0x00FFFFFF;
+		dst[1] = (w0 >> 24) | ((w1 & 0xFFFF) << 8);
+		dst[2] = (w1 >> 16) | ((w2 & 0xFF) << 16);
+		dst[3] = w2 >> 8;
+	}
+	for (; Width > 0; --Width, Image += 3) {
+		*dst++ = Image[0] | ((UINT32)Image[1] << 8) | ((UINT32)Image[2] << 16);
+	}
+}
+
+EFI_STATUS
 BmpToBlt(
 	IN CONST VOID      *BmpImage,
 	IN  UINTN     BmpImageSize,
@@ -588,10 +1081,27 @@ BmpToBlt(
 	BltBufferSize = MultU64x32(BltBufferSize, sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
 
 	*blt = MEM_ALLOC((UINTN)BltBufferSize + sizeof(**blt));
+	if (*blt == NULL) {
+		return EFI_OUT_OF_RESOURCES;
+	}
 
 	(*blt)->Width = BmpHeader->PixelWidth;
 	(*blt)->Height = BmpHeader->PixelHeight;
 
+	//
+	// 24/32 bpp: convert whole scanlines
+	//
+	if (BmpHeader->BitPerPixel == 24 || BmpHeader->BitPerPixel == 32) {
+		for (Height = 0; Height < BmpHeader->PixelHeight; Height++) {
+			BmpRowToBlt(
+				&(*blt)->Pixels[(BmpHeader->PixelHeight - Height - 1) * BmpHeader->PixelWidth],
+				ImageHeader + Height * DataSizePerLine,
+				BmpHeader->PixelWidth,
+				BmpHeader->BitPerPixel);
+		}
+		return EFI_SUCCESS;
+	}
+
 	//
 	// Convert image from BMP to Blt buffer format
 	//
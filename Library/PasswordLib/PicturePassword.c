@@ -190,28 +190,102 @@ DrawPwdZone(
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Picture layers
+//////////////////////////////////////////////////////////////////////////
+// Picture is decoded once and cells are rendered once for each layer
+// (hidden and visible characters). Redraw copies layer and adds selected cells.
+BLT_HEADER*	bltPwdBase = NULL;
+BLT_HEADER*	bltPwdLayers[2] = { NULL, NULL };
+VOID*			bltPwdLayersBmp = NULL;
+UINTN			bltPwdLayersStep = 0;
+
+EFI_STATUS
+PictPwdLayerCopy(
+	IN OUT BLT_HEADER**	dst,
+	IN BLT_HEADER*			src
+	) {
+	UINTN size = (UINTN)src->Width * src->Height * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+	if (*dst != NULL && ((*dst)->Width != src->Width || (*dst)->Height != src->Height)) {
+		MEM_FREE(*dst);
+		*dst = NULL;
+	}
+	if (*dst == NULL) {
+		*dst = (BLT_HEADER*)MEM_ALLOC(sizeof(BLT_HEADER) + size);
+		if (*dst == NULL) return EFI_OUT_OF_RESOURCES;
+		(*dst)->Width = src->Width;
+		(*dst)->Height = src->Height;
+	}
+	CopyMem((*dst)->Pixels, src->Pixels, size);
+	return EFI_SUCCESS;
+}
+
+VOID
+PictPwdLayersFree() {
+	UINTN i;
+	if (bltPwdBase != NULL) MEM_FREE(bltPwdBase);
+	bltPwdBase = NULL;
+	for (i = 0; i < 2; ++i) {
+		if (bltPwdLayers[i] != NULL) MEM_FREE(bltPwdLayers[i]);
+		bltPwdLayers[i] = NULL;
+	}
+	bltPwdLayersBmp = NULL;
+	bltPwdLayersStep = 0;
+}
+
+EFI_STATUS
+PictPwdLayerGet(
+	OUT BLT_HEADER**	layer
+	) {
+	EFI_STATUS   res;
+	UINTN        vis = gPasswordVisible ? 1 : 0;
+	UINTN		    cellX, cellY;
+
+	if (bltPwdLayersBmp != gPictPwdBmp || bltPwdLayersStep != step) {
+		PictPwdLayersFree();
+	}
+	if (bltPwdBase == NULL) {
+		res = BmpToBlt(gPictPwdBmp, gPictPwdBmpSize, &bltPwdBase);
+		if (EFI_ERROR(res)) {
+			return res;
+		}
+		bltPwdLayersBmp = gPictPwdBmp;
+		bltPwdLayersStep = step;
+	}
+	if (bltPwdLayers[vis] == NULL) {
+		res = PictPwdLayerCopy(&bltPwdLayers[vis], bltPwdBase);
+		if (EFI_ERROR(res)) {
+			return res;
+		}
+		cellY = 0;
+		do {
+			cellX = 0;
+			do {
+				CellUpdate(bltPwdLayers[vis], cellX, cellY, FALSE);
+				cellX++;
+			} while ((cellX + 1) * step <= (bltPwdBase->Width));
+			cellY++;
+		} while ((cellY + 1)* step <= (bltPwdBase->Height));
+	}
+	*layer = bltPwdLayers[vis];
+	return EFI_SUCCESS;
+}
+
 EFI_STATUS
 DrawPwdPicture()
 {
 	EFI_STATUS   res;
 	UINTN		    idx;
-	UINTN		    cellX, cellY;
-
-	if (bltPwd != NULL) MEM_FREE(bltPwd);
+	BLT_HEADER*  layer;
 
-	res = BmpToBlt(gPictPwdBmp, gPictPwdBmpSize, &bltPwd);
+	res = PictPwdLayerGet(&layer);
+	if (EFI_ERROR(res)) {
+		return res;
+	}
+	res = PictPwdLayerCopy(&bltPwd, layer);
 	if (EFI_ERROR(res)) {
 		return res;
 	}
-	cellY = 0;
-	do {
-		cellX = 0;
-		do {
-			CellUpdate(bltPwd, cellX, cellY, FALSE);
-			cellX++;
-		} while ((cellX + 1) * step <= (bltPwd->Width));
-		cellY++;
-	} while ((cellY + 1)* step <= (bltPwd->Height));
 
 	// Update selected
 	for (idx = 0; idx < picPwdIdx; ++idx) {
@@ -335,6 +409,7 @@ AskPictPwdInt(
 	res = DrawPwdPicture();
 	if (EFI_ERROR(res)) {
 		MEM_FREE(bltScrn);
+		PictPwdLayersFree();
 		ERR_PRINT(L"BmpToBlt - %r", res);
 		return;
 	}
@@ -411,6 +486,7 @@ AskPictPwdInt(
 		curPrevX = curX;
 		curPrevY = curY;
 		ZeroMem(&key, sizeof(key));
+		KeyIdleStep();
 		res = gBS->WaitForEvent(eventsCount, InputEvents, &EventIndex);
 		if (EventIndex == 0) {
 			res = gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
@@ -674,6 +750,8 @@ AskPictPwdInt(
 	gBS->CloseEvent(InputEvents[1]);
 	gBS->CloseEvent(UpdateEvent);
 	gBS->CloseEvent(BeepOffEvent);
+	BltTextCacheFree();
+	PictPwdLayersFree();
 	ScreenFillRect(&gColorBlack, 0, 0, sWidth, sHeight);
 	gBS->Stall(500000);
 }
@@ -16,7 +16,10 @@ https://opensource.org/licenses/Apache-2.0
 #include <DcsConfig.h>
 
 #include <Library/CommonLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include "common/Xml.h"
+#include "crypto/sha2.h"
 
 //////////////////////////////////////////////////////////////////////////
 // Config
@@ -26,16 +29,398 @@ UINTN	gConfigBufferSize = 0;
 char *gConfigBufferUpdated = NULL;
 UINTN	gConfigBufferUpdatedSize = 0;
 
+//////////////////////////////////////////////////////////////////////////
+// Config table
+//////////////////////////////////////////////////////////////////////////
+// DcsProp is parsed once to key/value hash table (open addressing). Strings
+// are packed to one buffer. Table is rebuilt if active XML buffer is changed.
+#define CONFIG_KEY_MAX    128
+#define CONFIG_VALUE_MAX  2048
+
+typedef struct _CONFIG_ENTRY {
+	UINT32   Hash;
+	UINT32   Key;                         // offset in strings, 0 - empty entry
+	UINT32   Value;
+	UINT32   ValueLen;
+	UINT32   IntParsed;
+	INT32    IntValue;
+} CONFIG_ENTRY;
+
+CONFIG_ENTRY*  gConfigTable = NULL;
+UINTN          gConfigTableSize = 0;     // power of 2
+char*          gConfigStrings = NULL;
+UINTN          gConfigStringsSize = 0;
+char*          gConfigTableXml = NULL;
+UINTN          gConfigTableXmlSize = 0;
+UINT8*         gConfigBin = NULL;        // table is mapped from DcsProp.bin
+
+UINT32
+ConfigKeyHash(
+	IN const char *key
+	)
+{
+	UINT32 hash = 2166136261u;
+	while (*key != 0) {
+		hash ^= (UINT8)*key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+CONFIG_ENTRY*
+ConfigTableFind(
+	IN const char *key,
+	IN UINT32     hash
+	)
+{
+	UINTN i = hash & (gConfigTableSize - 1);
+	while (gConfigTable[i].Key != 0) {
+		if (gConfigTable[i].Hash == hash && AsciiStrCmp(gConfigStrings + gConfigTable[i].Key, key) == 0) {
+			return &gConfigTable[i];
+		}
+		i = (i + 1) & (gConfigTableSize - 1);
+	}
+	return &gConfigTable[i];
+}
+
+VOID
+ConfigTableFree()
+{
+	if (gConfigBin != NULL) {
+		MEM_FREE(gConfigBin);
+	}	else {
+		MEM_FREE(gConfigTable);
+		MEM_FREE(gConfigStrings);
+	}
+	gConfigBin = NULL;
+	gConfigTable = NULL;
+	gConfigStrings = NULL;
+	gConfigStringsSize = 0;
+	gConfigTableSize = 0;
+	gConfigTableXml = NULL;
+	gConfigTableXmlSize = 0;
+}
+
 BOOLEAN
-ConfigRead(char *configKey, char *configValue, int maxValueSize)
+ConfigTableBuild(
+	IN char   *xml,
+	IN UINTN  xmlSize
+	)
+{
+	char          *node;
+	char          *key = NULL;
+	char          *value = NULL;
+	UINTN         count = 0;
+	UINTN         used = 1;
+	UINTN         len;
+	UINT32        hash;
+	CONFIG_ENTRY  *entry;
+
+	ConfigTableFree();
+	for (node = XmlFindElement(xml, "config"); node != NULL; node = XmlFindElement(node + 1, "config")) {
+		count++;
+	}
+	gConfigTableSize = 16;
+	while (gConfigTableSize < count * 2) gConfigTableSize <<= 1;
+	gConfigTable = MEM_ALLOC(gConfigTableSize * sizeof(CONFIG_ENTRY));
+	// Keys and values are not longer than their XML text
+	gConfigStrings = MEM_ALLOC(xmlSize + count * 2 + 1);
+	key = MEM_ALLOC(CONFIG_KEY_MAX);
+	value = MEM_ALLOC(CONFIG_VALUE_MAX);
+	if (gConfigTable == NULL || gConfigStrings == NULL || key == NULL || value == NULL) {
+		ConfigTableFree();
+		MEM_FREE(key);
+		MEM_FREE(value);
+		return FALSE;
+	}
+
+	for (node = XmlFindElement(xml, "config"); node != NULL; node = XmlFindElement(node + 1, "config")) {
+		if (XmlGetAttributeText(node, "key", key, CONFIG_KEY_MAX) == NULL || key[0] == 0) continue;
+		hash = ConfigKeyHash(key);
+		entry = ConfigTableFind(key, hash);
+		// First element wins as in XmlFindElementByAttributeValue
+		if (entry->Key != 0) continue;
+		XmlGetNodeText(node, value, CONFIG_VALUE_MAX);
+		entry->Hash = hash;
+		entry->Key = (UINT32)used;
+		len = AsciiStrLen(key);
+		CopyMem(gConfigStrings + used, key, len + 1);
+		used += len + 1;
+		entry->Value = (UINT32)used;
+		len = AsciiStrLen(value);
+		entry->ValueLen = (UINT32)len;
+		CopyMem(gConfigStrings + used, value, len + 1);
+		used += len + 1;
+	}
+	MEM_FREE(key);
+	MEM_BURN(value, CONFIG_VALUE_MAX);
+	MEM_FREE(value);
+	gConfigStringsSize = used;
+	gConfigTableXml = xml;
+	gConfigTableXmlSize = xmlSize;
+	return TRUE;
+}
+
+int
+ConfigParseInt(char *s)
+{
+	if (*s == '-') {
+		return (-1) * (int)AsciiStrDecimalToUintn(&s[1]);
+	}
+	return (int)AsciiStrDecimalToUintn(s);
+}
+
+VOID
+ConfigEntryParseInt(
+	IN OUT CONFIG_ENTRY *entry
+	)
+{
+	// Value longer than ConfigReadInt buffer is read as empty string
+	entry->IntValue = (entry->ValueLen < 32) ? ConfigParseInt(gConfigStrings + entry->Value) : 0;
+	entry->IntParsed = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Precompiled config
+//////////////////////////////////////////////////////////////////////////
+// DcsProp.bin is config table saved by DcsCfg with integers parsed. It is
+// used only if size and modification time of DcsProp match stamp, so
+// DcsProp edited after compilation is parsed as before. SHA-512 of DcsProp
+// is checked when XML is loaded anyway (TPM measurement).
+#define DCSPROP_FILE         L"\\EFI\\VeraCrypt\\DcsProp"
+#define DCSPROP_BIN_SIGN     SIGNATURE_64('D','C','S','P','R','B','I','N')
+#define DCSPROP_BIN_VERSION  1
+
+typedef struct _DCSPROP_BIN_HEADER {
+	UINT64    Sign;
+	UINT32    Size;                       // whole file
+	UINT32    Crc;                        // CRC32 of file with Crc = 0
+	UINT32    Version;
+	UINT32    EntrySize;
+	UINT32    Count;                      // entries (power of 2)
+	UINT32    StringsSize;
+	UINT32    XmlSize;
+	UINT32    Reserved;
+	EFI_TIME  XmlTime;
+	UINT8     XmlHash[SHA512_DIGEST_SIZE];
+} DCSPROP_BIN_HEADER;
+
+EFI_STATUS
+ConfigXmlStamp(
+	OUT UINT32    *size,
+	OUT EFI_TIME  *time
+	)
+{
+	EFI_STATUS     res;
+	EFI_FILE       *file;
+	EFI_FILE_INFO  *info = NULL;
+
+	res = FileOpen(NULL, DCSPROP_FILE, &file, EFI_FILE_MODE_READ, 0);
+	if (EFI_ERROR(res)) return res;
+	res = FileGetInfo(file, &info, NULL);
+	if (!EFI_ERROR(res)) {
+		*size = (UINT32)info->FileSize;
+		CopyMem(time, &info->ModificationTime, sizeof(EFI_TIME));
+		MEM_FREE(info);
+	}
+	FileClose(file);
+	return res;
+}
+
+VOID
+ConfigXmlHash(
+	IN  char   *xml,
+	IN  UINTN  xmlSize,
+	OUT UINT8  *hash
+	)
+{
+	sha512_ctx ctx;
+	sha512_begin(&ctx);
+	sha512_hash((unsigned char*)xml, (unsigned long)xmlSize, &ctx);
+	sha512_end(hash, &ctx);
+}
+
+BOOLEAN
+ConfigBinLoad()
 {
-	char *xml;
+	DCSPROP_BIN_HEADER *hdr;
+	CONFIG_ENTRY       *entries;
+	char               *strings;
+	UINT8              *bin = NULL;
+	UINTN              binSize = 0;
+	UINT32             crc = 0;
+	UINT32             crcSaved;
+	UINT32             xmlSize;
+	EFI_TIME           xmlTime;
+	UINTN              i;
 
+	if (FileLoad(NULL, DCSPROP_BIN_FILE, (VOID**)&bin, &binSize) != EFI_SUCCESS) return FALSE;
+	hdr = (DCSPROP_BIN_HEADER*)bin;
+	if (binSize < sizeof(DCSPROP_BIN_HEADER) ||
+		hdr->Sign != DCSPROP_BIN_SIGN || hdr->Size != binSize ||
+		hdr->Version != DCSPROP_BIN_VERSION || hdr->EntrySize != sizeof(CONFIG_ENTRY) ||
+		hdr->Count == 0 || (hdr->Count & (hdr->Count - 1)) != 0 || hdr->StringsSize == 0 ||
+		sizeof(DCSPROP_BIN_HEADER) + (UINT64)hdr->Count * sizeof(CONFIG_ENTRY) + hdr->StringsSize != binSize) {
+		goto fail;
+	}
+	crcSaved = hdr->Crc;
+	hdr->Crc = 0;
+	if (EFI_ERROR(gBS->CalculateCrc32(bin, binSize, &crc)) || crc != crcSaved) goto fail;
+	hdr->Crc = crcSaved;
+
+	// Stamp of source
+	if (EFI_ERROR(ConfigXmlStamp(&xmlSize, &xmlTime)) || xmlSize != hdr->XmlSize ||
+		CompareMem(&xmlTime, &hdr->XmlTime, sizeof(EFI_TIME)) != 0) {
+		goto fail;
+	}
+
+	entries = (CONFIG_ENTRY*)(bin + sizeof(DCSPROP_BIN_HEADER));
+	strings = (char*)(entries + hdr->Count);
+	if (strings[hdr->StringsSize - 1] != 0) goto fail;
+	for (i = 0; i < hdr->Count; ++i) {
+		if (entries[i].Key == 0) continue;
+		if (entries[i].Key >= hdr->StringsSize || entries[i].Value >= hdr->StringsSize ||
+			entries[i].ValueLen >= hdr->StringsSize - entries[i].Value ||
+			strings[entries[i].Value + entries[i].ValueLen] != 0) {
+			goto fail;
+		}
+	}
+
+	ConfigTableFree();
+	gConfigBin = bin;
+	gConfigTable = entries;
+	gConfigTableSize = hdr->Count;
+	gConfigStrings = strings;
+	gConfigStringsSize = hdr->StringsSize;
+	return TRUE;
+
+fail:
+	MEM_FREE(bin);
+	return FALSE;
+}
+
+EFI_STATUS
+ConfigBinSave()
+{
+	EFI_STATUS         res;
+	DCSPROP_BIN_HEADER *hdr;
+	UINT8              *bin;
+	UINTN              binSize;
+	UINT32             crc = 0;
+	UINTN              i;
+
+	// Source is DcsProp file only (not tables)
 	if (gConfigBuffer == NULL) {
-		if (FileLoad(NULL, L"\\EFI\\VeraCrypt\\DcsProp", &gConfigBuffer, &gConfigBufferSize) != EFI_SUCCESS) {
-			return FALSE;
+		res = FileLoad(NULL, DCSPROP_FILE, &gConfigBuffer, &gConfigBufferSize);
+		if (EFI_ERROR(res)) return res;
+	}
+	if (!ConfigTableBuild(gConfigBuffer, gConfigBufferSize)) return EFI_BUFFER_TOO_SMALL;
+	for (i = 0; i < gConfigTableSize; ++i) {
+		if (gConfigTable[i].Key != 0) ConfigEntryParseInt(&gConfigTable[i]);
+	}
+
+	binSize = sizeof(DCSPROP_BIN_HEADER) + gConfigTableSize * sizeof(CONFIG_ENTRY) + gConfigStringsSize;
+	bin = MEM_ALLOC(binSize);
+	if (bin == NULL) return EFI_BUFFER_TOO_SMALL;
+	hdr = (DCSPROP_BIN_HEADER*)bin;
+	res = ConfigXmlStamp(&hdr->XmlSize, &hdr->XmlTime);
+	if (EFI_ERROR(res)) goto error;
+	hdr->Sign = DCSPROP_BIN_SIGN;
+	hdr->Size = (UINT32)binSize;
+	hdr->Version = DCSPROP_BIN_VERSION;
+	hdr->EntrySize = sizeof(CONFIG_ENTRY);
+	hdr->Count = (UINT32)gConfigTableSize;
+	hdr->StringsSize = (UINT32)gConfigStringsSize;
+	ConfigXmlHash(gConfigBuffer, gConfigBufferSize, hdr->XmlHash);
+	CopyMem(bin + sizeof(DCSPROP_BIN_HEADER), gConfigTable, gConfigTableSize * sizeof(CONFIG_ENTRY));
+	CopyMem(bin + sizeof(DCSPROP_BIN_HEADER) + gConfigTableSize * sizeof(CONFIG_ENTRY), gConfigStrings, gConfigStringsSize);
+	res = gBS->CalculateCrc32(bin, binSize, &crc);
+	if (EFI_ERROR(res)) goto error;
+	hdr->Crc = crc;
+	res = FileSave(NULL, DCSPROP_BIN_FILE, bin, binSize);
+
+error:
+	MEM_FREE(bin);
+	return res;
+}
+
+BOOLEAN
+ConfigLoadSource()
+{
+	DCSPROP_BIN_HEADER *hdr;
+	UINT8              hash[SHA512_DIGEST_SIZE];
+	BOOLEAN            stale;
+
+	if (gConfigBuffer != NULL) return FALSE;
+	// DcsProp is loaded even if binary table was used and freed already
+	if (FileLoad(NULL, DCSPROP_FILE, &gConfigBuffer, &gConfigBufferSize) != EFI_SUCCESS) return FALSE;
+	if (gConfigBin == NULL) return FALSE;
+	hdr = (DCSPROP_BIN_HEADER*)gConfigBin;
+	ConfigXmlHash(gConfigBuffer, gConfigBufferSize, hash);
+	stale = CompareMem(hash, hdr->XmlHash, sizeof(hash)) != 0;
+	if (stale) {
+		// Next read parses DcsProp
+		ConfigTableFree();
+	}
+	return stale;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Config read
+//////////////////////////////////////////////////////////////////////////
+/**
+Entry of key in active config (DcsProp or updated from tables).
+NULL if not found or table can not be built.
+**/
+CONFIG_ENTRY*
+ConfigEntry(
+	IN  char      *configKey,
+	OUT BOOLEAN   *indexed
+	)
+{
+	char          *xml;
+	UINTN         xmlSize;
+	CONFIG_ENTRY  *entry;
+
+	*indexed = FALSE;
+	if (gConfigBuffer == NULL && gConfigBin == NULL) {
+		if (gConfigBufferUpdated != NULL || !ConfigBinLoad()) {
+			if (FileLoad(NULL, DCSPROP_FILE, &gConfigBuffer, &gConfigBufferSize) != EFI_SUCCESS) {
+				return NULL;
+			}
+		}
+	}
+	if (gConfigBufferUpdated != NULL || gConfigBin == NULL) {
+		xml = gConfigBufferUpdated != NULL ? gConfigBufferUpdated : gConfigBuffer;
+		xmlSize = gConfigBufferUpdated != NULL ? gConfigBufferUpdatedSize : gConfigBufferSize;
+		if (xml == NULL) return NULL;
+		if (gConfigTable == NULL || gConfigBin != NULL || gConfigTableXml != xml || gConfigTableXmlSize != xmlSize) {
+			if (!ConfigTableBuild(xml, xmlSize)) return NULL;
 		}
 	}
+	*indexed = TRUE;
+	entry = ConfigTableFind(configKey, ConfigKeyHash(configKey));
+	return (entry->Key != 0) ? entry : NULL;
+}
+
+BOOLEAN
+ConfigRead(char *configKey, char *configValue, int maxValueSize)
+{
+	char          *xml;
+	CONFIG_ENTRY  *entry;
+	BOOLEAN       indexed;
+
+	entry = ConfigEntry(configKey, &indexed);
+	if (entry != NULL) {
+		// Too long value is returned as empty string (XmlGetNodeText)
+		if (entry->ValueLen < (UINT32)maxValueSize) {
+			CopyMem(configValue, gConfigStrings + entry->Value, entry->ValueLen + 1);
+		}	else if (maxValueSize > 0) {
+			configValue[0] = 0;
+		}
+		return TRUE;
+	}
+	if (indexed) return FALSE;
 
 	xml = gConfigBufferUpdated != NULL? gConfigBufferUpdated : gConfigBuffer;
 	if (xml != NULL)
@@ -54,17 +439,25 @@ ConfigRead(char *configKey, char *configValue, int maxValueSize)
 int ConfigReadInt(char *configKey, int defaultValue)
 {
 	char s[32];
-	if (ConfigRead(configKey, s, sizeof(s))) {
-		if (*s == '-') {
-			return (-1) * (int)AsciiStrDecimalToUintn(&s[1]);
+	CONFIG_ENTRY  *entry;
+	BOOLEAN       indexed;
+
+	entry = ConfigEntry(configKey, &indexed);
+	if (entry != NULL) {
+		if (!entry->IntParsed) {
+			ConfigEntryParseInt(entry);
 		}
-		return (int)AsciiStrDecimalToUintn(s);
+		return entry->IntValue;
+	}
+	if (indexed) return defaultValue;
+
+	if (ConfigRead(configKey, s, sizeof(s))) {
+		return ConfigParseInt(s);
 	}
 	else
 		return defaultValue;
 }
 
-
 char *ConfigReadString(char *configKey, char *defaultValue, char *str, int maxLen)
 {
 	if (!ConfigRead(configKey, str, maxLen)) {
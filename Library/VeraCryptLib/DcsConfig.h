@@ -28,8 +28,14 @@ extern UINTN	gConfigBufferUpdatedSize;
 #define DCS_RESCUE_BOOT_VAR           L"DcsRescueBoot"
 #define DCS_RESCUE_EXEC_PART_GUID_VAR L"DcsRescueExecPartGuid"
 #define DCS_RESCUE_HEADER_BACKUP      L"\\EFI\\VeraCrypt\\svh_bak"
+#define DCSPROP_BIN_FILE              L"\\EFI\\VeraCrypt\\DcsProp.bin"
 
 BOOLEAN ConfigRead(char *configKey, char *configValue, int maxValueSize);
 int ConfigReadInt(char *configKey, int defaultValue);
 char *ConfigReadString(char *configKey, char *defaultValue, char *str, int maxLen);
+
+// Compile DcsProp to DCSPROP_BIN_FILE
+EFI_STATUS ConfigBinSave();
+// Load DcsProp (to measure) if not loaded. TRUE if mapped DCSPROP_BIN_FILE is stale (config is reloaded from DcsProp).
+BOOLEAN ConfigLoadSource();
 #endif
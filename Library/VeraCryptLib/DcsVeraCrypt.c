@@ -16,6 +16,8 @@ https://opensource.org/licenses/Apache-2.0
 #include <Uefi.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/PrintLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/SynchronizationLib.h>
 
 #include <Library/CommonLib.h>
 #include <Library/GraphLib.h>
@@ -25,6 +27,7 @@ https://opensource.org/licenses/Apache-2.0
 #include <common/Password.h>
 #include "common/Crypto.h"
 #include "common/Crc.h"
+#include "common/Volumes.h"
 #include "BootCommon.h"
 #include "Library/DcsTpmLib.h"
 #include <DcsConfig.h>
@@ -69,6 +72,7 @@ INT32 gRUD = 0;
 
 int gAuthSecRegionSearch = 0;
 int gSecRegionInfoDelay = 0;
+int gReadAhead = 0;
 
 CHAR8* gPlatformKeyFile = NULL;
 UINTN gPlatformKeyFileSize = 0;
@@ -178,9 +182,13 @@ VCAuthLoadConfig()
 	gRUD = ConfigReadInt("RUD", 0);
 
 	gRndDefault = ConfigReadInt("Random", 0);
+	gTraceSave = ConfigReadInt("TraceBoot", 0);
+	gRndTpmPoolSize = ConfigReadInt("RandomTpmPool", (int)gRndTpmPoolSize);
+	gRndTpmPoolLow = ConfigReadInt("RandomTpmPoolLow", (int)gRndTpmPoolLow);
 
 	gAuthSecRegionSearch = ConfigReadInt("SecRegionSearch", 0);
 	gSecRegionInfoDelay = ConfigReadInt("SecRegionInfoDelay", 0);
+	gReadAhead = ConfigReadInt("ReadAhead", 0);                       // KB read and decrypted ahead by DcsInt
 
 	gPlatformLocked = ConfigReadInt("PlatformLocked", 0);
 	gTPMLocked = ConfigReadInt("TPMLocked", 0);
@@ -441,17 +449,205 @@ VCAuthAsk()
 //////////////////////////////////////////////////////////////////////////
 // VeraCrypt helpers
 //////////////////////////////////////////////////////////////////////////
+// Boot services are not available on APs. While a parallel header trial runs
+// TCalloc/TCfree are served by a preallocated arena (free is no-op).
+#define VC_ARENA_SLICE_SIZE (256 * 1024)
+
+UINT8*          gVcArena = NULL;
+UINT32          gVcArenaSize = 0;
+volatile UINT32 gVcArenaUsed = 0;
+
 void* VeraCryptMemAlloc(IN UINTN size) {
-   return MEM_ALLOC(size);
+	UINT32 used;
+	UINT32 next;
+	if (gVcArena != NULL) {
+		if (size > gVcArenaSize) return NULL;
+		do {
+			used = gVcArenaUsed;
+			next = used + (UINT32)ALIGN_VALUE(size, 16);
+			if (next > gVcArenaSize) return NULL;
+		} while (InterlockedCompareExchange32(&gVcArenaUsed, used, next) != used);
+		return gVcArena + used;
+	}
+	return MEM_ALLOC(size);
 }
 
 void VeraCryptMemFree(IN VOID* ptr) {
-   MEM_FREE(ptr);
+	if (gVcArena != NULL && (UINT8*)ptr >= gVcArena && (UINT8*)ptr < gVcArena + gVcArenaSize) return;
+	MEM_FREE(ptr);
 }
 void ThrowFatalException(int line) {
    ERR_PRINT(L"Fatal %d\n", line);
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Parallel header trial
+//////////////////////////////////////////////////////////////////////////
+#define VC_PRF_COUNT    (LAST_PRF_ID - FIRST_PRF_ID + 1)
+#define VC_TRIAL_BATCH  32
+
+typedef struct _VC_HEADER_TRIAL {
+	BOOL            Boot;
+	char**          Headers;
+	UINTN           Base;                   // first header of batch
+	Password*       Pwd;
+	int             Prf;                    // 0 - every PRF
+	UINTN           PrfCount;
+	int             Pim;
+	volatile UINT32 Found;                  // slice + 1 of best success
+	int             Res[VC_TRIAL_BATCH];
+	PCRYPTO_INFO    Info[VC_TRIAL_BATCH];
+	PCRYPTO_INFO    HeaderInfo[VC_TRIAL_BATCH];
+} VC_HEADER_TRIAL;
+
+VOID
+VCHeaderTrialSlice(
+	IN VOID*  ctx,
+	IN UINTN  slice
+	)
+{
+	VC_HEADER_TRIAL* trial = (VC_HEADER_TRIAL*)ctx;
+	char             header[TC_VOLUME_HEADER_EFFECTIVE_SIZE];
+	int              res;
+	int              prf;
+	UINT32           found;
+
+	// Lower candidate already matched
+	found = trial->Found;
+	if (found != 0 && found <= slice + 1) {
+		trial->Res[slice] = ERR_PASSWORD_WRONG;
+		return;
+	}
+	prf = (trial->Prf != 0) ? trial->Prf : FIRST_PRF_ID + (int)(slice % trial->PrfCount);
+	CopyMem(header, trial->Headers[trial->Base + slice / trial->PrfCount], sizeof(header));
+	res = ReadVolumeHeader(trial->Boot, header, trial->Pwd, prf, trial->Pim,
+		&trial->Info[slice], trial->HeaderInfo[slice]);
+	trial->Res[slice] = res;
+	if (res == 0) {
+		// Keep lowest slice (first zone, then PRF order as serial search does)
+		do {
+			found = trial->Found;
+			if (found != 0 && found <= slice + 1) break;
+		} while (InterlockedCompareExchange32(&trial->Found, found, (UINT32)slice + 1) != found);
+	}
+	MEM_BURN(header, sizeof(header));
+}
+
+int
+ReadVolumeHeadersMp(
+	IN  BOOL          bBoot,
+	IN  char**        encryptedHeaders,
+	IN  UINTN         count,
+	IN  Password*     password,
+	IN  int           pkcs5_prf,
+	IN  int           pim,
+	OUT UINTN*        foundIdx,
+	OUT PCRYPTO_INFO* retInfo,
+	OUT CRYPTO_INFO*  retHeaderCryptoInfo
+	)
+{
+	VC_HEADER_TRIAL* trial = NULL;
+	UINT8*           arena = NULL;
+	UINT32           arenaSize = VC_TRIAL_BATCH * VC_ARENA_SLICE_SIZE;
+	UINTN            prfCount = (pkcs5_prf != 0) ? 1 : VC_PRF_COUNT;
+	UINTN            batchHeaders = VC_TRIAL_BATCH / prfCount;
+	UINTN            slices;
+	UINTN            i;
+	UINTN            win;
+	int              res = ERR_PASSWORD_WRONG;
+	BOOLEAN          serial = FALSE;
+
+	if (count == 0) return ERR_PASSWORD_WRONG;
+	if (gMpCpuCount > 1 && count * prfCount > 1) {
+		trial = (VC_HEADER_TRIAL*)MEM_ALLOC(sizeof(VC_HEADER_TRIAL));
+		arena = (UINT8*)AllocatePages(EFI_SIZE_TO_PAGES(arenaSize));
+	}
+	if (trial == NULL || arena == NULL) {
+		MEM_FREE(trial);
+		if (arena != NULL) FreePages(arena, EFI_SIZE_TO_PAGES(arenaSize));
+		serial = TRUE;
+		goto serial_search;
+	}
+	trial->Boot = bBoot;
+	trial->Headers = encryptedHeaders;
+	trial->Pwd = password;
+	trial->Prf = pkcs5_prf;
+	trial->PrfCount = prfCount;
+	trial->Pim = pim;
+
+	for (trial->Base = 0; trial->Base < count && res != 0 && !serial; trial->Base += batchHeaders) {
+		slices = MIN(count - trial->Base, batchHeaders) * prfCount;
+		ZeroMem(arena, arenaSize);
+		trial->Found = 0;
+		gVcArenaUsed = 0;
+		gVcArenaSize = arenaSize;
+		gVcArena = arena;
+		for (i = 0; i < slices; ++i) {
+			trial->Res[i] = ERR_PASSWORD_WRONG;
+			trial->Info[i] = NULL;
+			trial->HeaderInfo[i] = (retHeaderCryptoInfo != NULL) ? crypto_open() : NULL;
+		}
+		MpRunSlices(VCHeaderTrialSlice, trial, slices);
+		gVcArena = NULL;
+
+		if (trial->Found != 0) {
+			win = trial->Found - 1;
+			*retInfo = crypto_open();
+			if (*retInfo == NULL) {
+				res = ERR_OUTOFMEMORY;
+				break;
+			}
+			CopyMem(*retInfo, trial->Info[win], sizeof(CRYPTO_INFO));
+			if (retHeaderCryptoInfo != NULL) {
+				CopyMem(retHeaderCryptoInfo, trial->HeaderInfo[win], sizeof(CRYPTO_INFO));
+			}
+			if (foundIdx != NULL) *foundIdx = trial->Base + win / prfCount;
+			res = 0;
+		}	else {
+			for (i = 0; i < slices; ++i) {
+				// Arena is too small for this build. Search on BSP.
+				if (trial->Res[i] == ERR_OUTOFMEMORY) serial = TRUE;
+			}
+		}
+	}
+	MEM_BURN(arena, arenaSize);
+	FreePages(arena, EFI_SIZE_TO_PAGES(arenaSize));
+	MEM_BURN(trial, sizeof(VC_HEADER_TRIAL));
+	MEM_FREE(trial);
+
+serial_search:
+	if (serial) {
+		char header[TC_VOLUME_HEADER_EFFECTIVE_SIZE];
+		for (i = 0; i < count; ++i) {
+			CopyMem(header, encryptedHeaders[i], sizeof(header));
+			res = ReadVolumeHeader(bBoot, header, password, pkcs5_prf, pim, retInfo, retHeaderCryptoInfo);
+			if (res == 0) {
+				if (foundIdx != NULL) *foundIdx = i;
+				break;
+			}
+		}
+		MEM_BURN(header, sizeof(header));
+	}
+	return res;
+}
+
+int
+ReadVolumeHeaderMp(
+	IN  BOOL          bBoot,
+	IN  char*         encryptedHeader,
+	IN  Password*     password,
+	IN  int           pkcs5_prf,
+	IN  int           pim,
+	OUT PCRYPTO_INFO* retInfo,
+	OUT CRYPTO_INFO*  retHeaderCryptoInfo
+	)
+{
+	if (pkcs5_prf != 0) {
+		return ReadVolumeHeader(bBoot, encryptedHeader, password, pkcs5_prf, pim, retInfo, retHeaderCryptoInfo);
+	}
+	return ReadVolumeHeadersMp(bBoot, &encryptedHeader, 1, password, pkcs5_prf, pim, NULL, retInfo, retHeaderCryptoInfo);
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Random data
 //////////////////////////////////////////////////////////////////////////
@@ -18,6 +18,7 @@ https://opensource.org/licenses/Apache-2.0
 #include <Uefi.h>
 #include <common/Tcdefs.h>
 #include <common/Password.h>
+#include <common/Crypto.h>
 
 //////////////////////////////////////////////////////////////////////////
 // Auth
@@ -56,6 +57,7 @@ extern INT32 gRUD;
 
 extern int gAuthSecRegionSearch;
 extern int gSecRegionInfoDelay;
+extern int gReadAhead;
 
 extern int gPlatformLocked;
 extern int gTPMLocked;
@@ -90,6 +92,38 @@ VCAskPwd(
 VOID
 VCAuthLoadConfig();
 
+/**
+Try count headers, for pkcs5_prf 0 with every PRF, on all processors.
+Returns result of the first header (in array order) matched and its index.
+**/
+int
+ReadVolumeHeadersMp(
+	IN  BOOL          bBoot,
+	IN  char**        encryptedHeaders,
+	IN  UINTN         count,
+	IN  Password*     password,
+	IN  int           pkcs5_prf,
+	IN  int           pim,
+	OUT UINTN*        foundIdx,
+	OUT PCRYPTO_INFO* retInfo,
+	OUT CRYPTO_INFO*  retHeaderCryptoInfo
+	);
+
+/**
+ReadVolumeHeader with pkcs5_prf 0 (test all) runs every PRF on its own
+processor. The first match is returned. Others are same as ReadVolumeHeader.
+**/
+int
+ReadVolumeHeaderMp(
+	IN  BOOL          bBoot,
+	IN  char*         encryptedHeader,
+	IN  Password*     password,
+	IN  int           pkcs5_prf,
+	IN  int           pim,
+	OUT PCRYPTO_INFO* retInfo,
+	OUT CRYPTO_INFO*  retHeaderCryptoInfo
+	);
+
 VOID
 ApplyKeyFile(
 	IN OUT Password* password,